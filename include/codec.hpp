@@ -0,0 +1,155 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "json.hpp"
+#include "framing.hpp"
+
+// Gateway payload encodings. Every connection starts on JSON; a client can
+// ask for a binary encoding in its OP 2 identify and switches once the
+// server acknowledges it.
+enum class Encoding : uint8_t { json, msgpack, cbor };
+
+inline constexpr size_t encoding_count = 3;
+
+inline const char* encoding_name(Encoding encoding) {
+    switch (encoding) {
+        case Encoding::msgpack: return "msgpack";
+        case Encoding::cbor: return "cbor";
+        default: return "json";
+    }
+}
+
+inline bool parse_encoding(const std::string& name, Encoding& encoding) {
+    if (name == "json") encoding = Encoding::json;
+    else if (name == "msgpack") encoding = Encoding::msgpack;
+    else if (name == "cbor") encoding = Encoding::cbor;
+    else return false;
+    return true;
+}
+
+// One complete wire frame: JSON text plus '\n', or the binary marker, a
+// big-endian length and the MessagePack/CBOR body.
+// Strings that reached the store before decode_payload checked UTF-8 are
+// replaced with U+FFFD rather than letting dump() throw on them.
+inline std::string encode_payload(const nlohmann::json& payload, Encoding encoding) {
+    if (encoding == Encoding::json) {
+        std::string bytes = payload.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        bytes.push_back('\n');
+        return bytes;
+    }
+
+    std::string bytes(binary_frame_header, '\0');
+    if (encoding == Encoding::msgpack) nlohmann::json::to_msgpack(payload, bytes);
+    else nlohmann::json::to_cbor(payload, bytes);
+
+    uint32_t length = bytes.size() - binary_frame_header;
+    bytes[0] = static_cast<char>(binary_frame_marker);
+    for (int i = 0; i < 4; ++i) bytes[1 + i] = static_cast<char>(length >> (24 - 8 * i));
+    return bytes;
+}
+
+// Client payloads are a couple of levels deep; anything past this is hostile.
+// The binary readers recurse once per level, so the limit is what keeps a
+// frame of nested maps from running the reactor off its stack.
+inline constexpr size_t max_payload_depth = 32;
+
+inline bool valid_utf8(const std::string& text) {
+    size_t i = 0;
+    while (i < text.size()) {
+        uint8_t c = static_cast<uint8_t>(text[i]);
+        size_t extra;
+        uint32_t cp;
+        if (c < 0x80) { ++i; continue; }
+        else if (c >= 0xc2 && c <= 0xdf) { extra = 1; cp = c & 0x1f; }
+        else if (c >= 0xe0 && c <= 0xef) { extra = 2; cp = c & 0x0f; }
+        else if (c >= 0xf0 && c <= 0xf4) { extra = 3; cp = c & 0x07; }
+        else return false;
+        if (text.size() - i <= extra) return false;
+        for (size_t k = 1; k <= extra; ++k) {
+            uint8_t next = static_cast<uint8_t>(text[i + k]);
+            if ((next & 0xc0) != 0x80) return false;
+            cp = (cp << 6) | (next & 0x3f);
+        }
+        // Overlong forms, UTF-16 surrogates and anything past U+10FFFF.
+        if ((extra == 2 && cp < 0x800) || (extra == 3 && cp < 0x10000) ||
+            (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) return false;
+        i += extra + 1;
+    }
+    return true;
+}
+
+// Builds the DOM like json::parse/from_msgpack/from_cbor do, but fails the
+// parse once nesting passes max_payload_depth and, for the binary encodings,
+// on strings that aren't UTF-8. The JSON lexer already rejects those, while
+// MessagePack and CBOR hand back whatever bytes they were given, and dump()
+// would later throw on them while encoding the broadcast for a JSON client.
+class PayloadSax : public nlohmann::detail::json_sax_dom_parser<nlohmann::json> {
+public:
+    using json = nlohmann::json;
+
+    PayloadSax(json& result, bool binary)
+        : json_sax_dom_parser(result), check_utf8(binary) {}
+
+    // Why the handler stopped the parse, when it did.
+    const char* rejected = nullptr;
+
+    bool string(json::string_t& value) {
+        return checked(value, "invalid UTF-8 in string") && json_sax_dom_parser::string(value);
+    }
+    bool key(json::string_t& value) {
+        return checked(value, "invalid UTF-8 in key") && json_sax_dom_parser::key(value);
+    }
+    bool start_object(size_t length) {
+        return deeper() && json_sax_dom_parser::start_object(length);
+    }
+    bool end_object() {
+        --depth;
+        return json_sax_dom_parser::end_object();
+    }
+    bool start_array(size_t length) {
+        return deeper() && json_sax_dom_parser::start_array(length);
+    }
+    bool end_array() {
+        --depth;
+        return json_sax_dom_parser::end_array();
+    }
+
+private:
+    bool deeper() {
+        if (++depth <= max_payload_depth) return true;
+        rejected = "payload nested too deeply";
+        return false;
+    }
+    bool checked(const json::string_t& value, const char* what) {
+        if (!check_utf8 || valid_utf8(value)) return true;
+        rejected = what;
+        return false;
+    }
+
+    bool check_utf8;
+    size_t depth = 0;
+};
+
+// Parse a frame body from FrameBuffer::next_frame(). Payloads are always
+// objects, and an object's first byte already says which encoding it is in
+// (MessagePack maps start 0x80-0x8f/0xde/0xdf, CBOR maps 0xa0-0xbf), so
+// nothing has to track what the peer has switched to. Throws
+// nlohmann::json::exception on a malformed, over-nested or non-UTF-8 frame.
+inline nlohmann::json decode_payload(std::string_view frame) {
+    using input_format_t = nlohmann::json::input_format_t;
+    uint8_t first = frame.empty() ? 0 : static_cast<uint8_t>(frame[0]);
+    input_format_t format = input_format_t::json;
+    if ((first >= 0x80 && first <= 0x8f) || first == 0xde || first == 0xdf) format = input_format_t::msgpack;
+    else if (first >= 0xa0 && first <= 0xbf) format = input_format_t::cbor;
+
+    nlohmann::json result;
+    PayloadSax sax(result, format != input_format_t::json);
+    if (!nlohmann::json::sax_parse(frame.begin(), frame.end(), &sax, format))
+        throw nlohmann::json::parse_error::create(101, 0, sax.rejected ? sax.rejected : "malformed payload", nullptr);
+    return result;
+}
+
+#endif // CODEC_HPP
@@ -0,0 +1,134 @@
+#ifndef FRAMING_HPP
+#define FRAMING_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Binary gateway frames are this byte, a 4-byte big-endian length and the
+// body. 0xc1 can never start a UTF-8 JSON frame, so the two kinds can be
+// mixed on one stream.
+inline constexpr uint8_t binary_frame_marker = 0xc1;
+inline constexpr size_t binary_frame_header = 5;
+
+// Growable ring buffer that reassembles gateway frames, either
+// '\n'-terminated text or length-prefixed binary. recv() writes straight
+// into write_space(); next_frame() hands back each complete frame without
+// copying unless it happens to wrap the ring. Bytes already scanned for a
+// delimiter are not scanned again, so a large frame arriving in small
+// pieces stays linear.
+class FrameBuffer {
+public:
+    explicit FrameBuffer(size_t initial_capacity = 8192, size_t max_frame = 64 * 1024 * 1024)
+        : initial_capacity(round_up(initial_capacity)), max_frame(max_frame) {}
+
+    // Contiguous free space of at least one byte. Grows the ring when fewer
+    // than `min_free` bytes are free in total.
+    std::pair<char*, size_t> write_space(size_t min_free = 4096) {
+        if (size() == 0) {
+            read_pos = write_pos = scan_pos = 0;
+            if (capacity != initial_capacity && capacity > initial_capacity * 4) reallocate(initial_capacity);
+        }
+        if (capacity - size() < min_free) reallocate(std::max(initial_capacity, round_up(size() + min_free)));
+
+        size_t w = write_pos & (capacity - 1);
+        size_t r = read_pos & (capacity - 1);
+        size_t contiguous = (w >= r) ? capacity - w : r - w;
+        return {data.get() + w, contiguous};
+    }
+
+    void commit(size_t bytes) { write_pos += bytes; }
+
+    // Pops the next complete frame (without its '\n' or binary header). The
+    // view stays valid until the next call into the buffer.
+    bool next_frame(std::string_view& frame) {
+        if (scan_pos == read_pos && size() && byte_at(read_pos) == binary_frame_marker) return next_binary(frame);
+        while (scan_pos < write_pos) {
+            size_t s = scan_pos & (capacity - 1);
+            size_t run = std::min(write_pos - scan_pos, capacity - s);
+            const char* hit = static_cast<const char*>(memchr(data.get() + s, '\n', run));
+            if (!hit) {
+                scan_pos += run;
+                continue;
+            }
+
+            size_t end = scan_pos + (hit - (data.get() + s));
+            frame = view(read_pos, end - read_pos);
+            read_pos = scan_pos = end + 1;
+            return true;
+        }
+        return false;
+    }
+
+    size_t size() const { return write_pos - read_pos; }
+
+    // True once an incomplete frame is, or announces itself as, larger than
+    // max_frame.
+    bool overflowed() const { return oversized || size() > max_frame + binary_frame_header; }
+
+private:
+    std::unique_ptr<char[]> data;
+    size_t capacity = 0;
+    size_t initial_capacity;
+    size_t max_frame;
+    size_t read_pos = 0;  // absolute offsets; index = pos & (capacity - 1)
+    size_t write_pos = 0;
+    size_t scan_pos = 0;
+    std::string wrapped;  // scratch for a frame that straddles the end of the ring
+    bool oversized = false;
+
+    static size_t round_up(size_t n) {
+        size_t cap = 1;
+        while (cap < n) cap <<= 1;
+        return cap;
+    }
+
+    uint8_t byte_at(size_t pos) const { return static_cast<uint8_t>(data[pos & (capacity - 1)]); }
+
+    bool next_binary(std::string_view& frame) {
+        if (size() < binary_frame_header) return false;
+        size_t len = 0;
+        for (size_t i = 1; i < binary_frame_header; ++i) len = (len << 8) | byte_at(read_pos + i);
+        if (len > max_frame) {
+            oversized = true;
+            return false;
+        }
+        if (size() < binary_frame_header + len) return false;
+
+        frame = view(read_pos + binary_frame_header, len);
+        read_pos = scan_pos = read_pos + binary_frame_header + len;
+        return true;
+    }
+
+    std::string_view view(size_t pos, size_t len) {
+        size_t start = pos & (capacity - 1);
+        if (start + len <= capacity) return {data.get() + start, len};
+        size_t first = capacity - start;
+        wrapped.assign(data.get() + start, first);
+        wrapped.append(data.get(), len - first);
+        return wrapped;
+    }
+
+    void reallocate(size_t new_capacity) {
+        std::unique_ptr<char[]> grown(new char[new_capacity]);
+        size_t used = size();
+        if (used) {
+            size_t start = read_pos & (capacity - 1);
+            size_t first = std::min(used, capacity - start);
+            memcpy(grown.get(), data.get() + start, first);
+            memcpy(grown.get() + first, data.get(), used - first);
+        }
+        scan_pos -= read_pos;
+        write_pos = used;
+        read_pos = 0;
+        data = std::move(grown);
+        capacity = new_capacity;
+    }
+};
+
+#endif // FRAMING_HPP
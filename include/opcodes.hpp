@@ -0,0 +1,126 @@
+#ifndef OPCODES_HPP
+#define OPCODES_HPP
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+// Gateway opcodes. The same number is used in both directions where a
+// request and its event share a shape.
+enum class Op : uint8_t {
+    message_create = 0,
+    identify = 2,        // client: identify / server: encoding ack
+    presence = 3,        // server: everyone online
+    user_joined = 4,
+    user_left = 5,
+    voice_state = 6,
+    guild_create = 7,
+    channel_create = 8,
+    guild_tree = 9,
+    file_upload = 10,
+    file_list = 11,
+    file_download = 12,
+    history = 13,        // client: page request / server: the page
+    search = 14,         // client: full-text query / server: ranked results
+    message_failed = 15, // server: a message that could not be stored
+};
+
+inline constexpr size_t op_count = 16;
+
+// Typed field readers. They never insert missing keys and fail on a
+// missing or wrongly typed one instead of throwing.
+inline bool read_field(const nlohmann::json& d, const char* key, std::string& out) {
+    auto it = d.find(key);
+    if (it == d.end() || !it->is_string()) return false;
+    out = it->get_ref<const std::string&>();
+    return true;
+}
+
+inline bool read_field(const nlohmann::json& d, const char* key, int& out) {
+    auto it = d.find(key);
+    if (it == d.end() || !it->is_number_integer()) return false;
+    // get<int>() would truncate an out-of-range id into some other channel.
+    if (it->is_number_unsigned()) {
+        if (it->get<uint64_t>() > uint64_t(std::numeric_limits<int>::max())) return false;
+    } else {
+        int64_t value = it->get<int64_t>();
+        if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) return false;
+    }
+    out = static_cast<int>(it->get<int64_t>());
+    return true;
+}
+
+inline bool read_field(const nlohmann::json& d, const char* key, int64_t& out) {
+    auto it = d.find(key);
+    if (it == d.end() || !it->is_number_integer()) return false;
+    if (it->is_number_unsigned() && it->get<uint64_t>() > uint64_t(std::numeric_limits<int64_t>::max())) return false;
+    out = it->get<int64_t>();
+    return true;
+}
+
+inline bool read_field(const nlohmann::json& d, const char* key, bool& out) {
+    auto it = d.find(key);
+    if (it == d.end() || !it->is_boolean()) return false;
+    out = it->get<bool>();
+    return true;
+}
+
+// For optional fields: absent is fine, present must be well-typed.
+template <typename T>
+bool read_optional(const nlohmann::json& d, const char* key, T& out) {
+    return d.find(key) == d.end() || read_field(d, key, out);
+}
+
+inline bool read_strings(const nlohmann::json& d, std::vector<std::string>& out) {
+    if (!d.is_array()) return false;
+    out.clear();
+    for (auto& item : d) {
+        if (!item.is_string()) return false;
+        out.push_back(item.get<std::string>());
+    }
+    return true;
+}
+
+// Payload with no fields.
+struct NoFields {};
+inline bool parse(const nlohmann::json&, NoFields&) { return true; }
+
+// Routes a decoded payload to the handler registered for its opcode. The
+// op is read once and indexes a table; each route first parses "d" into
+// its request type with a `bool parse(const json&, Request&)` overload,
+// so handlers only ever see well-formed, typed fields.
+template <typename... Context>
+class Dispatcher {
+public:
+    enum class Result { handled, unknown_op, bad_frame };
+
+    template <typename Request, typename Handler>
+    void on(Op op, Handler handler) {
+        routes[static_cast<size_t>(op)] = [handler](Context... context, const nlohmann::json& d) {
+            Request request;
+            if (!parse(d, request)) return false;
+            handler(context..., request);
+            return true;
+        };
+    }
+
+    Result dispatch(Context... context, const nlohmann::json& payload) const {
+        auto op = payload.find("op");
+        if (op == payload.end() || !op->is_number_unsigned()) return Result::bad_frame;
+        uint64_t index = op->get<uint64_t>();
+        if (index >= op_count || !routes[index]) return Result::unknown_op;
+
+        static const nlohmann::json no_data;
+        auto d = payload.find("d");
+        return routes[index](context..., d != payload.end() ? *d : no_data) ? Result::handled : Result::bad_frame;
+    }
+
+private:
+    std::array<std::function<bool(Context..., const nlohmann::json&)>, op_count> routes;
+};
+
+#endif // OPCODES_HPP
@@ -0,0 +1,33 @@
+#ifndef VOICE_HPP
+#define VOICE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// UDP voice. OP 6 joins a voice channel and hands the joining client a
+// token. The client sends it from its UDP socket in a hello packet, which
+// binds that endpoint to its room, and repeats it every so often in case
+// one is lost. Every other datagram is audio.
+inline constexpr char voice_hello_magic[4] = {'T', 'C', 'V', 'H'};
+inline constexpr size_t voice_hello_size = sizeof(voice_hello_magic) + sizeof(uint64_t);
+
+// Audio datagrams carry at most this many bytes, 256 float samples, so
+// they cross a 1500-byte Ethernet MTU whole (1472 bytes of UDP payload)
+// rather than as IP fragments, and the relay can GSO-batch them.
+inline constexpr size_t voice_max_payload = 1024;
+
+// The token goes out big-endian, like the binary frame length.
+inline void encode_voice_hello(uint64_t token, char (&out)[voice_hello_size]) {
+    std::memcpy(out, voice_hello_magic, sizeof(voice_hello_magic));
+    for (size_t i = 0; i < sizeof(token); ++i) out[sizeof(voice_hello_magic) + i] = static_cast<char>(token >> (56 - 8 * i));
+}
+
+inline bool decode_voice_hello(const char* data, size_t size, uint64_t& token) {
+    if (size != voice_hello_size || std::memcmp(data, voice_hello_magic, sizeof(voice_hello_magic)) != 0) return false;
+    token = 0;
+    for (size_t i = 0; i < sizeof(token); ++i) token = token << 8 | static_cast<uint8_t>(data[sizeof(voice_hello_magic) + i]);
+    return true;
+}
+
+#endif // VOICE_HPP
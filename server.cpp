@@ -11,7 +11,22 @@
 #include "include/base64.hpp"
 #include <sys/socket.h>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
+#include "include/opcodes.hpp"
+#include "server/archive.hpp"
+#include "server/config.hpp"
+#include "server/database.hpp"
+#include "server/guild_tree.hpp"
+#include "server/message_log.hpp"
+#include "server/message_writer.hpp"
+#include "server/migrations.hpp"
+#include "server/reactor.hpp"
+#include "server/recent_messages.hpp"
+#include "server/voice_relay.hpp"
+#ifdef TERMICOMM_IO_URING
+#include "server/uring_reactor.hpp"
+#endif
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
@@ -25,337 +40,499 @@ void init_storage() {
     }
 }
 
-// --- UDP VOICE RELAY ---
-std::map<std::string, sockaddr_in> active_voice_users;
-std::mutex voice_mutex;
+// --- METRICS ---
+void metrics_reporter() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+        std::cout << "[METRICS] ";
+        write_metrics(std::cout);
+        std::cout << std::endl;
+    }
+}
 
-void udp_audio_relay() {
-    int udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
-    sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(8081); 
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+// DATABASE SCHEMA (see server/migrations.hpp)
+bool init_server_db() {
+    Database& db = local_db();
+    db.exec("PRAGMA journal_mode = WAL;");
+    if (!migrate(db)) return false;
+    guild_tree.load(db);
+    return true;
+}
 
-    if (bind(udp_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "[VOICE] UDP Bind failed!" << std::endl;
-        return;
+std::vector<std::unique_ptr<Reactor>> reactors;
+std::unique_ptr<MessageStore> message_store;
+std::unique_ptr<MessageWriter> message_writer;
+bool ack_after_commit = false;
+int login_history_window = 20;
+int voice_port = 8081;
+
+// Serialize into an immutable wire frame for one connection's encoding.
+Frame encode_frame(const json& payload, Encoding encoding) {
+    return std::make_shared<const std::string>(encode_payload(payload, encoding));
+}
+
+// Fan a payload out to every identified connection on every reactor. Each
+// reactor writes to its own sockets, so nothing here blocks on the network,
+// and the payload is serialized once per encoding in use, not per recipient.
+void broadcast(const json& payload, uint64_t ignore_id = 0) {
+    auto message = std::make_shared<const Broadcast>(payload);
+    for (auto& reactor : reactors) reactor->fanout(message, ignore_id);
+}
+
+// --- CLIENT REQUESTS ---
+struct Identify { std::string username; std::vector<std::string> encodings; };
+struct SendMessage { std::string content; int channel_id; };
+struct VoiceState { bool joining; int channel_id = 0; };
+struct CreateGuild { std::string name; };
+struct CreateChannel { int guild_id; std::string name; };
+struct UploadFile { std::string filename; std::string data; int channel_id; };
+struct DownloadFile { std::string filename; };
+struct FetchHistory { int channel_id; int64_t before = 0; int64_t after = 0; int limit = 50; };
+struct SearchMessages { std::string query; int channel_id = 0; int offset = 0; int limit = 25; };
+
+bool parse(const json& d, Identify& r) {
+    if (!read_field(d, "username", r.username)) return false;
+    auto offered = d.find("encodings");
+    return offered == d.end() || read_strings(*offered, r.encodings);
+}
+bool parse(const json& d, SendMessage& r) { return read_field(d, "content", r.content) && read_field(d, "channel_id", r.channel_id); }
+bool parse(const json& d, VoiceState& r) {
+    return read_field(d, "joining", r.joining) && read_optional(d, "channel_id", r.channel_id) && (!r.joining || r.channel_id > 0);
+}
+bool parse(const json& d, CreateGuild& r) { return read_field(d, "name", r.name); }
+bool parse(const json& d, CreateChannel& r) { return read_field(d, "guild_id", r.guild_id) && read_field(d, "name", r.name); }
+bool parse(const json& d, UploadFile& r) {
+    return read_field(d, "filename", r.filename) && read_field(d, "data", r.data) && read_field(d, "channel_id", r.channel_id);
+}
+bool parse(const json& d, DownloadFile& r) { return read_field(d, "filename", r.filename); }
+bool parse(const json& d, FetchHistory& r) {
+    return read_field(d, "channel_id", r.channel_id) && read_optional(d, "before", r.before) && read_optional(d, "after", r.after) &&
+           read_optional(d, "limit", r.limit);
+}
+bool parse(const json& d, SearchMessages& r) {
+    return read_field(d, "query", r.query) && read_optional(d, "channel_id", r.channel_id) && read_optional(d, "offset", r.offset) &&
+           read_optional(d, "limit", r.limit);
+}
+
+// An OP 13 frame: up to `limit` messages of one channel, oldest first. The
+// newest ones before `before` (or the newest overall), or the oldest ones
+// after `after`. has_more says whether the page stopped at the limit.
+json history_page(int channel_id, int64_t before, int64_t after, int limit) {
+    limit = std::clamp(limit, 1, 100);
+    bool forward = after > 0;
+    std::vector<RecentMessages::Message> rows;
+    bool has_more = false;
+
+    if (!recent_messages.page(channel_id, before, after, limit, rows, has_more)) {
+        size_t wanted = static_cast<size_t>(limit) + 1;
+        if (forward) message_store->read_after(channel_id, after, wanted, rows);
+        else message_store->read_before(channel_id, before > 0 ? before : INT64_MAX, wanted, rows);
+        has_more = rows.size() > static_cast<size_t>(limit);
+        if (has_more) rows.pop_back();
+        if (!forward) std::reverse(rows.begin(), rows.end());
     }
-    
-    std::cout << "[VOICE] UDP Audio Relay running on port 8081..." << std::endl;
 
-    char audio_buffer[4096];
-    sockaddr_in client_addr{};
-    socklen_t client_len = sizeof(client_addr);
+    json messages = json::array();
+    for (auto& row : rows) {
+        messages.push_back({
+            {"id", row.id}, {"channel_id", channel_id},
+            {"author", {{"username", std::move(row.author)}}}, {"content", std::move(row.content)}
+        });
+    }
 
-    while (true) {
-        int bytes = recvfrom(udp_sock, audio_buffer, sizeof(audio_buffer), 0, (struct sockaddr*)&client_addr, &client_len);
-        if (bytes > 0) {
-            char ip_str[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, INET_ADDRSTRLEN);
-            std::string client_key = std::string(ip_str) + ":" + std::to_string(ntohs(client_addr.sin_port));
-            
-            {
-                std::lock_guard<std::mutex> lock(voice_mutex);
-                active_voice_users[client_key] = client_addr;
-            }
+    json response = {{"op", 13}, {"d", {{"channel_id", channel_id}, {"messages", std::move(messages)}, {"has_more", has_more}}}};
+    if (forward) response["d"]["after"] = after;
+    else response["d"]["before"] = before;
+    return response;
+}
 
-            std::lock_guard<std::mutex> lock(voice_mutex);
-            for (auto const& [key, addr] : active_voice_users) {
-                if (key != client_key) {
-                    sendto(udp_sock, audio_buffer, bytes, 0, (struct sockaddr*)&addr, sizeof(addr));
-                }
+// Client text as an FTS5 query: every word must appear, each one quoted so
+// operators and punctuation in it are matched literally.
+std::string fts_query(const std::string& text) {
+    std::string query, word;
+    std::istringstream words(text);
+    while (words >> word) {
+        if (!query.empty()) query += ' ';
+        query += '"';
+        for (char c : word) {
+            if (c == '"') query += '"';
+            query += c;
+        }
+        query += '"';
+    }
+    return query;
+}
+
+// An OP 14 frame: messages matching `text`, best match first, optionally
+// only from one channel. Pages by offset into the ranking; has_more says
+// whether there is another page.
+json search_page(const std::string& text, int channel_id, int offset, int limit) {
+    limit = std::clamp(limit, 1, 100);
+    offset = std::max(offset, 0);
+    std::string query = fts_query(text);
+    json messages = json::array();
+    bool has_more = false;
+
+    if (!query.empty()) {
+        ReadPool::Snapshot snapshot = read_pool.snapshot();
+        Database& db = *snapshot;
+        Statement results = channel_id > 0
+            ? db.prepare("SELECT m.id, m.channel_id, m.author_name, m.content FROM messages_fts JOIN messages m ON m.id = messages_fts.rowid "
+                         "WHERE messages_fts MATCH ? AND m.channel_id = ? ORDER BY messages_fts.rank LIMIT ? OFFSET ?;")
+            : db.prepare("SELECT m.id, m.channel_id, m.author_name, m.content FROM messages_fts JOIN messages m ON m.id = messages_fts.rowid "
+                         "WHERE messages_fts MATCH ? ORDER BY messages_fts.rank LIMIT ? OFFSET ?;");
+        if (results) {
+            int index = 1;
+            results.bind(index++, query);
+            if (channel_id > 0) results.bind(index++, channel_id);
+            results.bind(index, limit + 1).bind(index + 1, offset);
+            while (results.next()) {
+                messages.push_back({
+                    {"id", results.column_int64(0)}, {"channel_id", results.column_int(1)},
+                    {"author", {{"username", results.column_text(2)}}}, {"content", results.column_text(3)}
+                });
             }
         }
+        has_more = messages.size() > static_cast<size_t>(limit);
+        if (has_more) messages.erase(messages.end() - 1);
     }
+
+    json response = {{"op", 14}, {"d", {{"query", text}, {"offset", offset}, {"messages", std::move(messages)}, {"has_more", has_more}}}};
+    if (channel_id > 0) response["d"]["channel_id"] = channel_id;
+    return response;
 }
 
-// DATABASE SCHEMA 
-void init_server_db() {
-    sqlite3* db;
-    sqlite3_open("termicomm_server.db", &db);
-    sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS users (username TEXT PRIMARY KEY, password TEXT);", 0, 0, 0);
-    sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS messages (id INTEGER PRIMARY KEY, channel_id INTEGER, author_name TEXT, content TEXT, timestamp DATETIME);", 0, 0, 0);
-    sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS guilds (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT);", 0, 0, 0);
-    sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS channels (id INTEGER PRIMARY KEY AUTOINCREMENT, guild_id INTEGER, name TEXT);", 0, 0, 0);
-    sqlite3_exec(db, "INSERT OR IGNORE INTO guilds (id, name) VALUES (1, 'General Lobby');", 0, 0, 0);
-    sqlite3_exec(db, "INSERT OR IGNORE INTO channels (id, guild_id, name) VALUES (1, 1, 'general');", 0, 0, 0);
-    sqlite3_close(db);
+// The first encoding the client offers that we speak, else JSON.
+Encoding negotiate_encoding(const std::vector<std::string>& offered) {
+    for (auto& name : offered) {
+        Encoding encoding;
+        if (parse_encoding(name, encoding)) return encoding;
+    }
+    return Encoding::json;
 }
 
-void handle_client(int client_socket) {
-    char buffer[8192]; 
-    std::string username = "Unknown";
-    bool identified = false;
+// OP 2
+void on_identify(Reactor& reactor, Connection& conn, const Identify& req) {
+    if (conn.identified) return;
+    conn.username = req.username;
+    std::cout << "[LOGIN] User '" << conn.username << "' identified." << std::endl;
+
+    // The ack goes out in JSON; everything after it in the new encoding.
+    Encoding encoding = negotiate_encoding(req.encodings);
+    if (encoding != Encoding::json) {
+        json ack = {{"op", 2}, {"d", {{"encoding", encoding_name(encoding)}}}};
+        reactor.send(conn, encode_frame(ack, Encoding::json));
+        conn.encoding = encoding;
+    }
 
-    auto broadcast = [&](const std::string& msg, int ignore_sock = -1) {
-        std::string formatted_msg = msg + "\n";
+    std::vector<std::string> current_users;
+    {
         std::lock_guard<std::mutex> lock(clients_mutex);
-        for (auto it = clients.begin(); it != clients.end(); ) {
-            if (it->socket != ignore_sock) {
-                if (send(it->socket, formatted_msg.c_str(), formatted_msg.length(), 0) < 0) {
-                    close(it->socket);
-                    it = clients.erase(it);
-                    continue;
-                }
+        clients.push_back({conn.fd, conn.username});
+        for (auto& u : clients) current_users.push_back(u.name);
+    }
+    conn.identified = true;
+
+    json sync_users = {{"op", 3}, {"d", current_users}};
+    reactor.send(conn, encode_frame(sync_users, conn.encoding));
+
+    json join_msg = {{"op", 4}, {"d", {{"username", conn.username}}}};
+    broadcast(join_msg, conn.id);
+
+    // OP 9, from the cached tree: every login between two changes queues
+    // the same encoded frame.
+    std::shared_ptr<const GuildTree::Snapshot> tree = guild_tree.snapshot();
+    reactor.send(conn, tree->payload->frame(conn.encoding));
+
+    // Then the newest few messages of the channel the client opens first,
+    // the first one in the tree, as one OP 13 page once the tree is on its
+    // way out. Every other channel the client fetches when it is opened.
+    if (login_history_window > 0 && !tree->channel_ids.empty()) {
+        reactor.stream(conn, [channel_id = tree->channel_ids.front()](Reactor& reactor, Connection& conn) {
+            reactor.send(conn, encode_frame(history_page(channel_id, 0, 0, login_history_window), conn.encoding));
+            return false;
+        });
+    }
+}
+
+json message_created(int channel_id, const std::string& author, const std::string& content, int64_t id) {
+    return {
+        {"op", 0}, {"t", "MESSAGE_CREATE"},
+        {"d", {{"id", id}, {"content", content}, {"channel_id", channel_id}, {"author", {{"username", author}}}}}
+    };
+}
+
+// OP 0
+void on_message_create(Reactor&, Connection& conn, const SendMessage& req) {
+    // The writer thread batches the INSERT with everyone else's. By default
+    // the message goes out straight away; with ack_after_commit it goes out
+    // from the writer once its batch is on disk, built there from the id it
+    // commits under, so the two threads never share the payload.
+    // The recent-message ring is fed alongside the broadcast, so history
+    // never shows a message its channel has not seen.
+    // If the writer gives up on it, everyone hears so over OP 15: in the
+    // default mode they have already shown it, and the sender needs to know
+    // either way.
+    // This runs on the writer thread, outside on_client_frame's catch.
+    MessageWriter::Committed on_commit = [channel_id = req.channel_id, author = conn.username, content = req.content](int64_t id, bool stored) {
+        try {
+            if (!stored) {
+                if (!ack_after_commit) recent_messages.remove(channel_id, id);
+                broadcast({{"op", 15}, {"d", {{"id", id}, {"channel_id", channel_id}, {"author", {{"username", author}}}}}});
+            } else if (ack_after_commit) {
+                recent_messages.add(channel_id, {id, author, content});
+                broadcast(message_created(channel_id, author, content, id));
             }
-            ++it;
+        } catch (json::exception& e) {
+            ++metrics.rejected_frames;
+            std::cerr << "[ERR] Could not broadcast message " << id << ": " << e.what() << std::endl;
         }
     };
+    int64_t id = message_writer->submit({0, req.channel_id, conn.username, req.content, std::move(on_commit)});
+    if (!ack_after_commit) {
+        recent_messages.add(req.channel_id, {id, conn.username, req.content});
+        broadcast(message_created(req.channel_id, conn.username, req.content, id));
+    }
+}
 
-    while (true) {
-        memset(buffer, 0, sizeof(buffer));
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-        
-        if (bytes_received <= 0) {
-            std::cout << "[LOG] User '" << username << "' disconnected." << std::endl;
-            json left_msg = {{"op", 5}, {"d", {{"username", username}}}};
-            broadcast(left_msg.dump(), client_socket);
-
-            std::lock_guard<std::mutex> lock(clients_mutex);
-            for (auto it = clients.begin(); it != clients.end(); ++it) {
-                if (it->socket == client_socket) {
-                    clients.erase(it); break;
-                }
-            }
-            break; 
+// OP 6. The joiner alone gets the token for its UDP hello, and the port
+// to send it to. Joining another channel leaves the current one, and
+// everyone hears about that leave first.
+void on_voice_state(Reactor& reactor, Connection& conn, const VoiceState& req) {
+    int channel_id = req.channel_id;
+    if (req.joining) {
+        int previous;
+        uint64_t token = voice_rooms.join(conn.id, channel_id, previous);
+        if (previous) broadcast({{"op", 6}, {"d", {{"username", conn.username}, {"joining", false}, {"channel_id", previous}}}});
+        json joined = {{"op", 6}, {"d", {{"username", conn.username}, {"joining", true}, {"channel_id", channel_id}, {"token", token}, {"port", voice_port}}}};
+        reactor.send(conn, encode_frame(joined, conn.encoding));
+    } else if ((channel_id = voice_rooms.leave(conn.id)) == 0) {
+        return;
+    }
+    json voice_msg = {{"op", 6}, {"d", {{"username", conn.username}, {"joining", req.joining}, {"channel_id", channel_id}}}};
+    broadcast(voice_msg, req.joining ? conn.id : 0);
+}
+
+// OP 7
+void on_guild_create(Reactor&, Connection&, const CreateGuild& req) {
+    int new_guild_id = -1;
+
+    Database& db = local_db();
+    if (Statement insert = db.prepare("INSERT INTO guilds (name) VALUES (?);")) {
+        if (insert.bind(1, req.name).exec()) new_guild_id = db.last_insert_rowid();
+    }
+
+    if (new_guild_id != -1) {
+        guild_tree.add_guild(new_guild_id, req.name);
+        json outbound = {{"op", 7}, {"d", {{"id", new_guild_id}, {"name", req.name}}}};
+        broadcast(outbound);
+    }
+}
+
+// OP 8
+void on_channel_create(Reactor&, Connection&, const CreateChannel& req) {
+    int new_channel_id = -1;
+
+    Database& db = local_db();
+    if (Statement insert = db.prepare("INSERT INTO channels (guild_id, name) VALUES (?, ?);")) {
+        if (insert.bind(1, req.guild_id).bind(2, req.name).exec()) new_channel_id = db.last_insert_rowid();
+    }
+
+    if (new_channel_id != -1) {
+        guild_tree.add_channel(new_channel_id, req.guild_id, req.name);
+        recent_messages.add_channel(new_channel_id);
+        json outbound = {{"op", 8}, {"d", {{"id", new_channel_id}, {"guild_id", req.guild_id}, {"name", req.name}}}};
+        broadcast(outbound);
+    }
+}
+
+// --- OP 10: FILE UPLOAD (BASE64 DECODE) ---
+void on_file_upload(Reactor& reactor, Connection&, const UploadFile& req) {
+    init_storage();
+    std::string decoded_data = base64_decode(req.data); // DECODE TO BINARY
+
+    if (reactor.write_file("shared_files/" + req.filename, decoded_data)) {
+        json announce = {
+            {"op", 0}, {"t", "MESSAGE_CREATE"},
+            {"d", {
+                {"content", "[FILE UPLOADED]: " + req.filename}, 
+                {"channel_id", req.channel_id}, 
+                {"author", {{"username", "SYSTEM"}}}
+            }}
+        };
+        broadcast(announce);
+    }
+}
+
+// --- OP 11: REQUEST FILE LIST ---
+void on_file_list(Reactor& reactor, Connection& conn, const NoFields&) {
+    json file_list = json::array();
+    if (fs::exists("shared_files")) {
+        for (const auto& entry : fs::directory_iterator("shared_files")) {
+            file_list.push_back(entry.path().filename().string());
         }
+    }
+    json response = {{"op", 11}, {"d", file_list}};
+    reactor.send(conn, encode_frame(response, conn.encoding));
+}
 
-        buffer[bytes_received] = '\0';
+// --- OP 12: REQUEST FILE DOWNLOAD (BASE64 ENCODE) ---
+void on_file_download(Reactor& reactor, Connection& conn, const DownloadFile& req) {
+    std::string raw_content;
+    if (reactor.read_file("shared_files/" + req.filename, raw_content)) {
+        std::string encoded_content = base64_encode(raw_content); // ENCODE TO BASE64
         
-        try {
-            json payload = json::parse(buffer);
-
-            // OP 2
-            if (payload["op"] == 2 && !identified) {
-                username = payload["d"]["username"];
-                std::cout << "[LOGIN] User '" << username << "' identified." << std::endl;
-                
-                std::vector<std::string> current_users;
-                {
-                    std::lock_guard<std::mutex> lock(clients_mutex);
-                    clients.push_back({client_socket, username});
-                    for (auto& u : clients) current_users.push_back(u.name);
-                }
-                identified = true;
-
-                json sync_users = {{"op", 3}, {"d", current_users}};
-                std::string sync_str = sync_users.dump() + "\n";
-                send(client_socket, sync_str.c_str(), sync_str.length(), 0);
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                
-                json join_msg = {{"op", 4}, {"d", {{"username", username}}}};
-                broadcast(join_msg.dump(), client_socket);
-
-                // OP 9
-                json tree_msg = {{"op", 9}, {"d", json::array()}};
-                sqlite3* db;
-                if (sqlite3_open("termicomm_server.db", &db) == SQLITE_OK) {
-                    sqlite3_stmt* stmt;
-                    if (sqlite3_prepare_v2(db, "SELECT id, name FROM guilds;", -1, &stmt, 0) == SQLITE_OK) {
-                        while(sqlite3_step(stmt) == SQLITE_ROW) {
-                            int g_id = sqlite3_column_int(stmt, 0);
-                            std::string g_name = (const char*)sqlite3_column_text(stmt, 1);
-                            json guild_obj = {{"id", g_id}, {"name", g_name}, {"channels", json::array()}};
-                            
-                            sqlite3_stmt* stmt2;
-                            if (sqlite3_prepare_v2(db, "SELECT id, name FROM channels WHERE guild_id = ?;", -1, &stmt2, 0) == SQLITE_OK) {
-                                sqlite3_bind_int(stmt2, 1, g_id);
-                                while(sqlite3_step(stmt2) == SQLITE_ROW) {
-                                    guild_obj["channels"].push_back({
-                                        {"id", sqlite3_column_int(stmt2, 0)},
-                                        {"name", (const char*)sqlite3_column_text(stmt2, 1)}
-                                    });
-                                }
-                                sqlite3_finalize(stmt2);
-                            }
-                            tree_msg["d"].push_back(guild_obj);
-                        }
-                    }
-                    sqlite3_finalize(stmt);
-                    
-                    std::string tree_str = tree_msg.dump() + "\n";
-                    send(client_socket, tree_str.c_str(), tree_str.length(), 0);
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-                    sqlite3_stmt* hist_stmt;
-                    std::string sql = "SELECT channel_id, author_name, content FROM messages ORDER BY id ASC;";
-                    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &hist_stmt, 0) == SQLITE_OK) {
-                        while (sqlite3_step(hist_stmt) == SQLITE_ROW) {
-                            int ch_id = sqlite3_column_int(hist_stmt, 0);
-                            std::string msg_author = (const char*)sqlite3_column_text(hist_stmt, 1);
-                            std::string msg_content = (const char*)sqlite3_column_text(hist_stmt, 2);
-
-                            json hist_msg = {
-                                {"op", 0}, {"t", "MESSAGE_CREATE"},
-                                {"d", {{"content", msg_content}, {"channel_id", ch_id}, {"author", {{"username", msg_author}}}}}
-                            };
-                            std::string hist_str = hist_msg.dump() + "\n";
-                            send(client_socket, hist_str.c_str(), hist_str.length(), 0);
-                            std::this_thread::sleep_for(std::chrono::milliseconds(50)); 
-                        }
-                    }
-                    sqlite3_finalize(hist_stmt);
-                    sqlite3_close(db);
-                }
-            }
-            
-            // OP 0
-            else if (payload["op"] == 0) {
-                std::string content = payload["d"]["content"];
-                int channel_id = payload["d"]["channel_id"];
-
-                sqlite3* db;
-                if (sqlite3_open("termicomm_server.db", &db) == SQLITE_OK) {
-                    sqlite3_stmt* stmt;
-                    std::string sql = "INSERT INTO messages (channel_id, author_name, content, timestamp) VALUES (?, ?, ?, datetime('now'));";
-                    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) == SQLITE_OK) {
-                        sqlite3_bind_int(stmt, 1, channel_id);
-                        sqlite3_bind_text(stmt, 2, username.c_str(), -1, SQLITE_STATIC);
-                        sqlite3_bind_text(stmt, 3, content.c_str(), -1, SQLITE_STATIC);
-                        sqlite3_step(stmt);
-                    }
-                    sqlite3_finalize(stmt);
-                    sqlite3_close(db);
-                }
-
-                json outbound = {
-                    {"op", 0}, {"t", "MESSAGE_CREATE"},
-                    {"d", {{"content", content}, {"channel_id", channel_id}, {"author", {{"username", username}}}}}
-                };
-                broadcast(outbound.dump());
-            }
+        json response = {{"op", 12}, {"d", {{"filename", req.filename}, {"data", encoded_content}}}};
+        reactor.send(conn, encode_frame(response, conn.encoding));
+    }
+}
 
-            else if (payload["op"] == 6) {
-                bool is_joining = payload["d"]["joining"];
-                json voice_msg = {{"op", 6}, {"d", {{"username", username}, {"joining", is_joining}}}};
-                broadcast(voice_msg.dump());
-            }
+// --- OP 13: HISTORY PAGE ---
+void on_history(Reactor& reactor, Connection& conn, const FetchHistory& req) {
+    reactor.send(conn, encode_frame(history_page(req.channel_id, req.before, req.after, req.limit), conn.encoding));
+}
 
-            else if (payload["op"] == 7) {
-                std::string server_name = payload["d"]["name"];
-                int new_guild_id = -1;
-
-                sqlite3* db;
-                if (sqlite3_open("termicomm_server.db", &db) == SQLITE_OK) {
-                    sqlite3_stmt* stmt;
-                    if (sqlite3_prepare_v2(db, "INSERT INTO guilds (name) VALUES (?);", -1, &stmt, 0) == SQLITE_OK) {
-                        sqlite3_bind_text(stmt, 1, server_name.c_str(), -1, SQLITE_STATIC);
-                        sqlite3_step(stmt);
-                        new_guild_id = sqlite3_last_insert_rowid(db);
-                    }
-                    sqlite3_finalize(stmt);
-                    sqlite3_close(db);
-                }
-
-                if (new_guild_id != -1) {
-                    json outbound = {{"op", 7}, {"d", {{"id", new_guild_id}, {"name", server_name}}}};
-                    broadcast(outbound.dump());
-                }
-            }
+// --- OP 14: MESSAGE SEARCH ---
+void on_search(Reactor& reactor, Connection& conn, const SearchMessages& req) {
+    reactor.send(conn, encode_frame(search_page(req.query, req.channel_id, req.offset, req.limit), conn.encoding));
+}
 
-            else if (payload["op"] == 8) {
-                int target_guild_id = payload["d"]["guild_id"];
-                std::string channel_name = payload["d"]["name"];
-                int new_channel_id = -1;
-
-                sqlite3* db;
-                if (sqlite3_open("termicomm_server.db", &db) == SQLITE_OK) {
-                    sqlite3_stmt* stmt;
-                    if (sqlite3_prepare_v2(db, "INSERT INTO channels (guild_id, name) VALUES (?, ?);", -1, &stmt, 0) == SQLITE_OK) {
-                        sqlite3_bind_int(stmt, 1, target_guild_id);
-                        sqlite3_bind_text(stmt, 2, channel_name.c_str(), -1, SQLITE_STATIC);
-                        sqlite3_step(stmt);
-                        new_channel_id = sqlite3_last_insert_rowid(db);
-                    }
-                    sqlite3_finalize(stmt);
-                    sqlite3_close(db);
-                }
-
-                if (new_channel_id != -1) {
-                    json outbound = {{"op", 8}, {"d", {{"id", new_channel_id}, {"guild_id", target_guild_id}, {"name", channel_name}}}};
-                    broadcast(outbound.dump());
-                }
-            }
+using ClientOps = Dispatcher<Reactor&, Connection&>;
+ClientOps client_ops;
+
+void register_client_ops() {
+    client_ops.on<Identify>(Op::identify, on_identify);
+    client_ops.on<SendMessage>(Op::message_create, on_message_create);
+    client_ops.on<VoiceState>(Op::voice_state, on_voice_state);
+    client_ops.on<CreateGuild>(Op::guild_create, on_guild_create);
+    client_ops.on<CreateChannel>(Op::channel_create, on_channel_create);
+    client_ops.on<UploadFile>(Op::file_upload, on_file_upload);
+    client_ops.on<NoFields>(Op::file_list, on_file_list);
+    client_ops.on<DownloadFile>(Op::file_download, on_file_download);
+    client_ops.on<FetchHistory>(Op::history, on_history);
+    client_ops.on<SearchMessages>(Op::search, on_search);
+}
 
-            // --- FILE UPLOAD (BASE64 DECODE) ---
-            else if (payload["op"] == 10) {
-                std::string filename = payload["d"]["filename"];
-                std::string encoded_data = payload["d"]["data"];
-                int channel_id = payload["d"]["channel_id"];
-
-                init_storage();
-                std::string decoded_data = base64_decode(encoded_data); // DECODE TO BINARY
-
-                std::ofstream outfile("shared_files/" + filename, std::ios::binary);
-                if (outfile.is_open()) {
-                    outfile << decoded_data;
-                    outfile.close();
-
-                    json announce = {
-                        {"op", 0}, {"t", "MESSAGE_CREATE"},
-                        {"d", {
-                            {"content", "[FILE UPLOADED]: " + filename}, 
-                            {"channel_id", channel_id}, 
-                            {"author", {{"username", "SYSTEM"}}}
-                        }}
-                    };
-                    broadcast(announce.dump());
-                }
-            }
+void on_client_frame(Reactor& reactor, Connection& conn, std::string_view frame) {
+    if (frame.empty()) return;
+    try {
+        json payload = decode_payload(frame);
+        if (client_ops.dispatch(reactor, conn, payload) == ClientOps::Result::bad_frame) {
+            ++metrics.rejected_frames;
+            std::cerr << "[ERR] Rejected malformed frame from '" << conn.username << "'" << std::endl;
+        }
+    } catch (json::parse_error& e) {
+        ++metrics.rejected_frames;
+        std::cerr << "[ERR] Parse Fail: " << e.what() << std::endl;
+    } catch (json::exception& e) {
+        // A handler or an encoder tripped over the frame's contents; drop
+        // the frame, not the server.
+        ++metrics.rejected_frames;
+        std::cerr << "[ERR] Dropped frame from '" << conn.username << "': " << e.what() << std::endl;
+    }
+}
 
-            // --- OP 11: REQUEST FILE LIST ---
-            else if (payload["op"] == 11) {
-                json file_list = json::array();
-                if (fs::exists("shared_files")) {
-                    for (const auto& entry : fs::directory_iterator("shared_files")) {
-                        file_list.push_back(entry.path().filename().string());
-                    }
-                }
-                json response = {{"op", 11}, {"d", file_list}};
-                std::string p = response.dump() + "\n";
-                send(client_socket, p.c_str(), p.length(), 0);
-            }
+void on_client_close(Reactor&, Connection& conn) {
+    std::cout << "[LOG] User '" << conn.username << "' disconnected." << std::endl;
+    json left_msg = {{"op", 5}, {"d", {{"username", conn.username}}}};
+    broadcast(left_msg, conn.id);
+    if (int channel_id = voice_rooms.leave(conn.id)) {
+        json voice_msg = {{"op", 6}, {"d", {{"username", conn.username}, {"joining", false}, {"channel_id", channel_id}}}};
+        broadcast(voice_msg, conn.id);
+    }
 
-            // --- OP 12: REQUEST FILE DOWNLOAD (BASE64 ENCODE) ---
-            else if (payload["op"] == 12) {
-                std::string filename = payload["d"]["filename"];
-                std::ifstream file("shared_files/" + filename, std::ios::binary);
-                if (file.is_open()) {
-                    std::string raw_content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-                    std::string encoded_content = base64_encode(raw_content); // ENCODE TO BASE64
-                    
-                    json response = {{"op", 12}, {"d", {{"filename", filename}, {"data", encoded_content}}}};
-                    std::string p = response.dump() + "\n";
-                    send(client_socket, p.c_str(), p.length(), 0);
-                }
-            }            
-
-        } catch (json::parse_error& e) {
-             std::cerr << "[ERR] Parse Fail: " << e.what() << std::endl;
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    for (auto it = clients.begin(); it != clients.end(); ++it) {
+        if (it->socket == conn.fd) {
+            clients.erase(it); break;
         }
     }
-    close(client_socket);
+}
+
+int open_listener(int port, bool reuseport) {
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport) setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    sockaddr_in address{AF_INET, htons(port), INADDR_ANY};
+    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(server_fd, SOMAXCONN) < 0) {
+        std::cerr << "[ERR] Could not listen on port " << port << std::endl;
+        close(server_fd);
+        return -1;
+    }
+    return server_fd;
 }
 
 int main() {
-    init_server_db();
+    ServerConfig config = load_config("termicomm_server.conf");
+    database_options.synchronous = config.db_synchronous;
+    database_options.mmap_size = config.db_mmap_size;
+    database_options.cache_size_kib = config.db_cache_size;
+    database_options.checkpoint_pages = config.db_checkpoint_pages;
+    if (!init_server_db()) return 1;
+    read_pool.open(database_path, config.db_read_connections ? config.db_read_connections : std::max(1u, std::thread::hardware_concurrency()));
+    if (config.message_store == "log") {
+        message_store = std::make_unique<LogMessageStore>("message_log", config.message_log_segment_bytes);
+    } else if (!config.log_store_guilds.empty()) {
+        std::vector<int> log_guilds = config.log_store_guilds;
+        message_store = std::make_unique<RoutedMessageStore>(
+            std::make_unique<SqliteMessageStore>(), std::make_unique<LogMessageStore>("message_log", config.message_log_segment_bytes),
+            [log_guilds](int channel_id) {
+                return std::find(log_guilds.begin(), log_guilds.end(), guild_tree.guild_of(channel_id)) != log_guilds.end();
+            });
+    } else {
+        message_store = std::make_unique<SqliteMessageStore>();
+    }
+    recent_messages.set_capacity(config.history_cache_size);
+    recent_messages.warm(*message_store, guild_tree.snapshot()->channel_ids);
+    archive.configure("archive", config.message_retention_days, config.archive_segment_messages);
     init_storage();
+    register_client_ops();
     
     // Start UDP Audio Relay
-    std::thread(udp_audio_relay).detach();
-
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    sockaddr_in address{AF_INET, htons(8080), INADDR_ANY};
-    bind(server_fd, (struct sockaddr*)&address, sizeof(address));
-    listen(server_fd, 3);
+    voice_relay(config.voice_port, config.voice_workers ? config.voice_workers : std::max(1u, std::thread::hardware_concurrency()), config.voice_batch,
+                config.voice_gso, config.voice_path_mtu);
+    std::thread(metrics_reporter).detach();
+    std::thread(&Checkpointer::run, &checkpointer, database_path, std::chrono::seconds(config.db_checkpoint_interval)).detach();
+    if (config.message_retention_days > 0) std::thread(&Archive::run, &archive, std::chrono::seconds(config.archive_interval)).detach();
+
+    message_writer = std::make_unique<MessageWriter>(*message_store, config.message_batch_size, std::chrono::microseconds(config.message_batch_delay_us));
+    ack_after_commit = config.message_ack_after_commit;
+    login_history_window = config.login_history_window;
+    voice_port = config.voice_port;
+    std::thread(&MessageWriter::run, message_writer.get()).detach();
+
+    const char* backend = "epoll";
+#ifdef TERMICOMM_IO_URING
+    bool use_uring = UringReactor::supported();
+    if (use_uring) backend = "io_uring";
+    else std::cerr << "[WARN] io_uring unavailable on this kernel, falling back to epoll" << std::endl;
+#endif
+
+    // One reactor per core. With reuseport each one gets its own listener
+    // and the kernel spreads incoming connections across them; otherwise
+    // they all wait on one shared socket.
+    unsigned reactor_count = config.reactors ? config.reactors : std::max(1u, std::thread::hardware_concurrency());
+    int shared_fd = config.reuseport ? -1 : open_listener(config.gateway_port, false);
+    for (unsigned i = 0; i < reactor_count; ++i) {
+        int listen_fd = config.reuseport ? open_listener(config.gateway_port, true) : shared_fd;
+        if (listen_fd < 0) return 1;
+        std::unique_ptr<Reactor> reactor;
+#ifdef TERMICOMM_IO_URING
+        if (use_uring) reactor = std::make_unique<UringReactor>(listen_fd);
+#endif
+        if (!reactor) reactor = std::make_unique<EpollReactor>(listen_fd);
+        reactor->on_frame = on_client_frame;
+        reactor->on_close = on_client_close;
+        reactors.push_back(std::move(reactor));
+    }
 
-    std::cout << "Termicomm Server (JSON Gateway) running on port 8080..." << std::endl;
-    while (true) {
-        int new_socket = accept(server_fd, nullptr, nullptr);
-        std::thread(handle_client, new_socket).detach();
+    std::cout << "Termicomm Server (JSON Gateway) running on port " << config.gateway_port << " with " << reactor_count
+              << (config.reuseport ? " SO_REUSEPORT " : " ") << backend << " reactor(s)..." << std::endl;
+    for (unsigned i = 1; i < reactor_count; ++i) {
+        std::thread(&Reactor::run, reactors[i].get()).detach();
     }
+    reactors[0]->run();
     return 0;
-}
\ No newline at end of file
+}
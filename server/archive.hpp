@@ -0,0 +1,280 @@
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "database.hpp"
+#include "metrics.hpp"
+
+// Cold storage for old chat messages. A background compactor moves each
+// channel's messages older than the retention age out of the messages
+// table into immutable, zlib-compressed segment files of `segment_messages`
+// messages each, recorded in archive_segments by channel and id range.
+// A channel's archive is always older than what is left in the table, so
+// history reads the table first and then the segments behind it.
+class Archive {
+public:
+    void configure(std::string archive_directory, int retention_days, size_t messages_per_segment) {
+        directory = std::move(archive_directory);
+        retention = retention_days;
+        segment_messages = std::max<size_t>(1, messages_per_segment);
+    }
+
+    // The compactor thread. Does nothing while retention is 0.
+    void run(std::chrono::seconds interval) {
+        while (true) {
+            if (retention > 0) compact();
+            std::this_thread::sleep_for(interval);
+        }
+    }
+
+    // One pass over every channel. Only full segments are written; a
+    // channel's last few old messages stay in the table until they fill one.
+    void compact() {
+        Database& db = local_db();
+        std::vector<int> channel_ids;
+        if (Statement channels = db.prepare("SELECT DISTINCT channel_id FROM messages;")) {
+            while (channels.next()) channel_ids.push_back(channels.column_int(0));
+        }
+
+        std::string cutoff = "-" + std::to_string(retention) + " days";
+        for (int channel_id : channel_ids) {
+            // Archive a prefix of the channel, up to its first message that
+            // is still young (or its newest now, not one committed later),
+            // so everything archived stays older than what is in the table.
+            int64_t boundary = 0;
+            {
+                Statement young = db.prepare(
+                    "SELECT COALESCE(MIN(CASE WHEN timestamp >= datetime('now', ?) THEN id END), MAX(id) + 1) FROM messages WHERE channel_id = ?;");
+                if (!young) return;
+                if (young.bind(1, cutoff).bind(2, channel_id).next()) boundary = young.column_int64(0);
+            }
+
+            while (true) {
+                std::vector<StoredMessage> rows;
+                {
+                    Statement oldest = db.prepare("SELECT id, author_name, content FROM messages WHERE channel_id = ? AND id < ? ORDER BY id LIMIT ?;");
+                    if (!oldest) return;
+                    oldest.bind(1, channel_id).bind(2, boundary).bind(3, static_cast<int64_t>(segment_messages));
+                    while (oldest.next()) rows.push_back({oldest.column_int64(0), oldest.column_text(1), oldest.column_text(2)});
+                }
+                if (rows.size() < segment_messages || !archive(db, channel_id, rows)) break;
+            }
+        }
+    }
+
+    // Up to `count` archived messages of `channel_id` older than `before`,
+    // newest first, appended to `out`.
+    void read_before(Database& db, int channel_id, int64_t before, size_t count, std::vector<StoredMessage>& out) {
+        Statement segments = db.prepare("SELECT file FROM archive_segments WHERE channel_id = ? AND first_id < ? ORDER BY last_id DESC;");
+        if (!segments) return;
+        segments.bind(1, channel_id).bind(2, before);
+        while (count > 0 && segments.next()) {
+            std::shared_ptr<const Segment> segment = load(segments.column_text(0));
+            if (!segment) return;
+            auto& messages = segment->messages;
+            auto end = std::lower_bound(messages.begin(), messages.end(), before, [](const StoredMessage& m, int64_t id) { return m.id < id; });
+            for (auto it = end; it != messages.begin() && count > 0; --count) out.push_back(*--it);
+        }
+    }
+
+    // Up to `count` archived messages of `channel_id` newer than `after`,
+    // oldest first, appended to `out`.
+    void read_after(Database& db, int channel_id, int64_t after, size_t count, std::vector<StoredMessage>& out) {
+        Statement segments = db.prepare("SELECT file FROM archive_segments WHERE channel_id = ? AND last_id > ? ORDER BY last_id ASC;");
+        if (!segments) return;
+        segments.bind(1, channel_id).bind(2, after);
+        while (count > 0 && segments.next()) {
+            std::shared_ptr<const Segment> segment = load(segments.column_text(0));
+            if (!segment) return;
+            auto& messages = segment->messages;
+            auto first = std::upper_bound(messages.begin(), messages.end(), after, [](int64_t id, const StoredMessage& m) { return id < m.id; });
+            for (auto it = first; it != messages.end() && count > 0; ++it, --count) out.push_back(*it);
+        }
+    }
+
+private:
+    // Segment file: this header, in host byte order, then the zlib-compressed
+    // messages, each as id, author length, author, content length, content.
+    struct Header {
+        char magic[4] = {'T', 'C', 'A', '1'};
+        int32_t channel_id = 0;
+        uint32_t count = 0;
+        uint32_t raw_size = 0;
+        int64_t first_id = 0;
+        int64_t last_id = 0;
+    };
+
+    struct Segment {
+        std::vector<StoredMessage> messages;  // ascending by id
+    };
+
+    static constexpr size_t cached_segments = 16;
+
+    std::string directory = "archive";
+    int retention = 0;
+    size_t segment_messages = 4096;
+
+    // Recently read segments, most recent first. Paging back through one
+    // segment decompresses it once.
+    std::mutex cache_mutex;
+    std::list<std::pair<std::string, std::shared_ptr<const Segment>>> cache;
+
+    // Write `rows` out as one segment, then record it and drop them from
+    // the table in one transaction. A crash before the commit leaves an
+    // orphan file that the next pass overwrites.
+    bool archive(Database& db, int channel_id, const std::vector<StoredMessage>& rows) {
+        Header header;
+        header.channel_id = channel_id;
+        header.count = static_cast<uint32_t>(rows.size());
+        header.first_id = rows.front().id;
+        header.last_id = rows.back().id;
+        std::string file = std::to_string(channel_id) + "-" + std::to_string(header.first_id) + "-" + std::to_string(header.last_id) + ".seg";
+        if (!write_segment(file, header, rows)) return false;
+
+        if (!db.exec("BEGIN IMMEDIATE;")) return false;
+        bool moved = false;
+        {
+            Statement record = db.prepare("INSERT INTO archive_segments (channel_id, first_id, last_id, count, file) VALUES (?, ?, ?, ?, ?);");
+            Statement drop = db.prepare("DELETE FROM messages WHERE channel_id = ? AND id BETWEEN ? AND ?;");
+            moved = record && drop &&
+                    record.bind(1, channel_id).bind(2, header.first_id).bind(3, header.last_id).bind(4, static_cast<int64_t>(header.count)).bind(5, file).exec() &&
+                    drop.bind(1, channel_id).bind(2, header.first_id).bind(3, header.last_id).exec();
+        }
+        if (!moved || !db.exec("COMMIT;")) {
+            db.exec("ROLLBACK;");
+            std::cerr << "[ARCHIVE] Could not archive " << file << std::endl;
+            return false;
+        }
+        metrics.messages_archived += rows.size();
+        return true;
+    }
+
+    bool write_segment(const std::string& file, Header& header, const std::vector<StoredMessage>& rows) {
+        std::string raw;
+        for (auto& row : rows) {
+            append(raw, row.id);
+            append(raw, static_cast<uint32_t>(row.author.size()));
+            raw += row.author;
+            append(raw, static_cast<uint32_t>(row.content.size()));
+            raw += row.content;
+        }
+        header.raw_size = static_cast<uint32_t>(raw.size());
+
+        std::string compressed(compressBound(raw.size()), '\0');
+        uLongf compressed_size = compressed.size();
+        if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size, reinterpret_cast<const Bytef*>(raw.data()), raw.size(), 6) != Z_OK) {
+            return false;
+        }
+
+        // Written under a temporary name, so a segment is either complete or absent.
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        std::string path = directory + "/" + file;
+        {
+            std::ofstream out(path + ".tmp", std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(compressed.data(), static_cast<std::streamsize>(compressed_size));
+            if (!out.flush()) return false;
+        }
+        // Durable before the rows it replaces are deleted.
+        int fd = ::open((path + ".tmp").c_str(), O_RDONLY);
+        bool synced = fd >= 0 && ::fsync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        if (!synced) return false;
+        std::filesystem::rename(path + ".tmp", path, error);
+        return !error;
+    }
+
+    std::shared_ptr<const Segment> load(const std::string& file) {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            for (auto it = cache.begin(); it != cache.end(); ++it) {
+                if (it->first != file) continue;
+                cache.splice(cache.begin(), cache, it);
+                return it->second;
+            }
+        }
+
+        std::shared_ptr<const Segment> segment = read_segment(directory + "/" + file);
+        if (!segment) {
+            std::cerr << "[ARCHIVE] Could not read " << file << std::endl;
+            return nullptr;
+        }
+        ++metrics.archive_segment_reads;
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        cache.emplace_front(file, segment);
+        if (cache.size() > cached_segments) cache.pop_back();
+        return segment;
+    }
+
+    static std::shared_ptr<const Segment> read_segment(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        Header header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, Header().magic, sizeof(header.magic)) != 0) {
+            return nullptr;
+        }
+        std::string compressed((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        std::string raw(header.raw_size, '\0');
+        uLongf raw_size = raw.size();
+        if (uncompress(reinterpret_cast<Bytef*>(raw.data()), &raw_size, reinterpret_cast<const Bytef*>(compressed.data()), compressed.size()) != Z_OK ||
+            raw_size != raw.size()) {
+            return nullptr;
+        }
+
+        auto segment = std::make_shared<Segment>();
+        segment->messages.reserve(header.count);
+        size_t at = 0;
+        for (uint32_t i = 0; i < header.count; ++i) {
+            StoredMessage message;
+            uint32_t length;
+            if (!take(raw, at, message.id) || !take(raw, at, length) || !take(raw, at, length, message.author) ||
+                !take(raw, at, length) || !take(raw, at, length, message.content)) {
+                return nullptr;
+            }
+            segment->messages.push_back(std::move(message));
+        }
+        return segment;
+    }
+
+    template <typename T>
+    static void append(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static bool take(const std::string& in, size_t& at, T& value) {
+        if (in.size() - at < sizeof(value)) return false;
+        std::memcpy(&value, in.data() + at, sizeof(value));
+        at += sizeof(value);
+        return true;
+    }
+
+    static bool take(const std::string& in, size_t& at, uint32_t length, std::string& value) {
+        if (in.size() - at < length) return false;
+        value.assign(in, at, length);
+        at += length;
+        return true;
+    }
+};
+
+inline Archive archive;
+
+#endif // ARCHIVE_HPP
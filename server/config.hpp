@@ -0,0 +1,132 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Startup settings, read from a `key = value` file. Lines starting with '#'
+// are comments; a missing file leaves every default in place.
+struct ServerConfig {
+    int gateway_port = 8080;
+    unsigned reactors = 0;   // 0 = one per core
+    bool reuseport = false;  // one SO_REUSEPORT listener per reactor instead of a shared one
+    int voice_port = 8081;   // UDP voice relay
+    unsigned voice_workers = 0;  // relay threads sharing voice_port through SO_REUSEPORT, 0 = one per core
+    unsigned voice_batch = 32;   // datagrams per recvmmsg
+    bool voice_gso = false;      // coalesce datagrams to one listener into UDP_SEGMENT sends
+    unsigned voice_path_mtu = 1500;  // IP packets to listeners must fit this for voice_gso to coalesce them
+
+    // termicomm_server.db. The database always runs in WAL mode.
+    std::string db_synchronous = "NORMAL";   // OFF, NORMAL or FULL
+    int64_t db_mmap_size = 256LL << 20;      // bytes of the file to memory-map, 0 = off
+    int db_cache_size = 16384;               // page cache per connection, KiB
+    int db_checkpoint_pages = 1000;          // checkpoint once the WAL is this long
+    int db_checkpoint_interval = 30;         // ...or this many seconds after the last one
+    unsigned db_read_connections = 0;        // read-only connections for history and search, 0 = one per core
+
+    // Group commit for chat messages.
+    unsigned message_batch_size = 256;       // commit once this many are queued...
+    unsigned message_batch_delay_us = 2000;  // ...or the oldest has waited this long
+    bool message_ack_after_commit = false;   // broadcast only once the message is durable
+    int login_history_window = 20;           // newest messages of the first channel sent at login, 0 = none
+    unsigned history_cache_size = 256;       // newest messages per channel kept in memory, 0 = off
+
+    // Where messages are stored: "sqlite" (termicomm_server.db) or "log"
+    // (the mmap'd append-only logs under message_log/).
+    std::string message_store = "sqlite";
+    std::vector<int> log_store_guilds;       // with the sqlite store, these guilds' channels still go to the log
+    int64_t message_log_segment_bytes = 64LL << 20;
+
+    // Cold archive for old messages.
+    int message_retention_days = 0;          // older messages move to archive segments, 0 = keep all in the database
+    unsigned archive_segment_messages = 4096;  // messages per compressed segment
+    int archive_interval = 3600;             // seconds between compaction passes
+};
+
+inline bool parse_bool(const std::string& value) {
+    return value == "1" || value == "true" || value == "yes" || value == "on";
+}
+
+inline std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+// A comma-separated list, e.g. "1, 4, 7".
+inline std::vector<int> parse_ints(const std::string& value) {
+    std::vector<int> out;
+    std::stringstream items(value);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        item = trim(item);
+        if (!item.empty()) out.push_back(std::stoi(item));
+    }
+    return out;
+}
+
+inline ServerConfig load_config(const std::string& path) {
+    ServerConfig config;
+    std::ifstream ifs(path);
+    if (!ifs.is_open()) return config;
+
+    std::string line;
+    while (std::getline(ifs, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = trim(line.substr(0, eq));
+        std::string value = trim(line.substr(eq + 1));
+
+        try {
+            if (key == "gateway_port") config.gateway_port = std::stoi(value);
+            else if (key == "reactors") config.reactors = std::stoul(value);
+            else if (key == "reuseport") config.reuseport = parse_bool(value);
+            else if (key == "voice_port") config.voice_port = std::stoi(value);
+            else if (key == "voice_workers") config.voice_workers = std::stoul(value);
+            else if (key == "voice_batch") config.voice_batch = std::stoul(value);
+            else if (key == "voice_gso") config.voice_gso = parse_bool(value);
+            else if (key == "voice_path_mtu") config.voice_path_mtu = std::stoul(value);
+            else if (key == "db_synchronous") {
+                std::string mode = value;
+                std::transform(mode.begin(), mode.end(), mode.begin(), [](unsigned char c) { return std::toupper(c); });
+                if (mode != "OFF" && mode != "NORMAL" && mode != "FULL") throw std::invalid_argument(value);
+                config.db_synchronous = mode;
+            }
+            else if (key == "db_mmap_size") config.db_mmap_size = std::stoll(value);
+            else if (key == "db_cache_size") config.db_cache_size = std::stoi(value);
+            else if (key == "db_checkpoint_pages") config.db_checkpoint_pages = std::stoi(value);
+            else if (key == "db_checkpoint_interval") config.db_checkpoint_interval = std::stoi(value);
+            else if (key == "db_read_connections") config.db_read_connections = std::stoul(value);
+            else if (key == "message_batch_size") config.message_batch_size = std::stoul(value);
+            else if (key == "message_batch_delay_us") config.message_batch_delay_us = std::stoul(value);
+            else if (key == "message_ack_after_commit") config.message_ack_after_commit = parse_bool(value);
+            else if (key == "login_history_window") config.login_history_window = std::stoi(value);
+            else if (key == "history_cache_size") config.history_cache_size = std::stoul(value);
+            else if (key == "message_store") {
+                if (value != "sqlite" && value != "log") throw std::invalid_argument(value);
+                config.message_store = value;
+            }
+            else if (key == "log_store_guilds") config.log_store_guilds = parse_ints(value);
+            else if (key == "message_log_segment_bytes") config.message_log_segment_bytes = std::stoll(value);
+            else if (key == "message_retention_days") config.message_retention_days = std::stoi(value);
+            else if (key == "archive_segment_messages") config.archive_segment_messages = std::stoul(value);
+            else if (key == "archive_interval") config.archive_interval = std::stoi(value);
+            else std::cerr << "[CONFIG] Unknown key '" << key << "'" << std::endl;
+        } catch (const std::exception&) {
+            std::cerr << "[CONFIG] Bad value for '" << key << "': " << value << std::endl;
+        }
+    }
+    return config;
+}
+
+#endif // CONFIG_HPP
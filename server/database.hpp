@@ -0,0 +1,279 @@
+#ifndef DATABASE_HPP
+#define DATABASE_HPP
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "metrics.hpp"
+
+// Per-connection tuning, filled in from the server config before any
+// worker opens its connection.
+struct DatabaseOptions {
+    std::string synchronous = "NORMAL";
+    int64_t mmap_size = 256LL << 20;
+    int cache_size_kib = 16384;
+    int checkpoint_pages = 1000;
+};
+
+inline DatabaseOptions database_options;
+
+// One chat message as history pages carry it.
+struct StoredMessage {
+    int64_t id;
+    std::string author;
+    std::string content;
+};
+
+// Runs WAL checkpoints on its own connection and thread. Workers never
+// checkpoint inside their own commits. Once the WAL passes
+// checkpoint_pages their commit hook asks for one, and there is also one
+// every interval.
+class Checkpointer {
+public:
+    void request() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending) return;
+            pending = true;
+        }
+        wake.notify_one();
+    }
+
+    void run(const std::string& path, std::chrono::seconds interval);
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool pending = false;
+};
+
+inline Checkpointer checkpointer;
+
+// A borrowed prepared statement. Goes back to its cache reset and with its
+// bindings cleared when it leaves scope, so it never pins a read
+// transaction. Bound text is SQLITE_STATIC: it must outlive the last step().
+class Statement {
+public:
+    explicit Statement(sqlite3_stmt* stmt = nullptr) : stmt(stmt) {}
+    Statement(Statement&& other) noexcept : stmt(std::exchange(other.stmt, nullptr)) {}
+    Statement(const Statement&) = delete;
+    Statement& operator=(const Statement&) = delete;
+
+    ~Statement() {
+        if (!stmt) return;
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+
+    explicit operator bool() const { return stmt != nullptr; }
+
+    // Parameters are 1-based, as in SQL.
+    Statement& bind(int index, int value) {
+        sqlite3_bind_int(stmt, index, value);
+        return *this;
+    }
+
+    Statement& bind(int index, int64_t value) {
+        sqlite3_bind_int64(stmt, index, value);
+        return *this;
+    }
+
+    Statement& bind(int index, const std::string& value) {
+        sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+        return *this;
+    }
+
+    // True while there is a row to read.
+    bool next() { return sqlite3_step(stmt) == SQLITE_ROW; }
+
+    // Run a statement that returns no rows.
+    bool exec() { return sqlite3_step(stmt) == SQLITE_DONE; }
+
+    // Columns are 0-based, as in sqlite3_column_*.
+    int column_int(int index) const { return sqlite3_column_int(stmt, index); }
+    int64_t column_int64(int index) const { return sqlite3_column_int64(stmt, index); }
+    bool column_null(int index) const { return sqlite3_column_type(stmt, index) == SQLITE_NULL; }
+
+    std::string column_text(int index) const {
+        const unsigned char* text = sqlite3_column_text(stmt, index);
+        return text ? std::string(reinterpret_cast<const char*>(text), sqlite3_column_bytes(stmt, index)) : std::string();
+    }
+
+private:
+    sqlite3_stmt* stmt;
+};
+
+// A long-lived connection with every statement it has run kept prepared.
+// SQLite connections are not shared between threads at once: each worker
+// writes through its own from local_db(), and reads borrow one from
+// read_pool.
+class Database {
+public:
+    explicit Database(const std::string& path, bool read_only = false) {
+        int flags = read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        if (sqlite3_open_v2(path.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+            std::cerr << "[DB] Could not open " << path << ": " << sqlite3_errmsg(db) << std::endl;
+        }
+        // Other workers hold their own connections to the same file.
+        sqlite3_busy_timeout(db, 5000);
+
+        const DatabaseOptions& options = database_options;
+        exec(("PRAGMA synchronous = " + options.synchronous + ";").c_str());
+        exec(("PRAGMA mmap_size = " + std::to_string(options.mmap_size) + ";").c_str());
+        exec(("PRAGMA cache_size = " + std::to_string(-options.cache_size_kib) + ";").c_str());
+        // Once a checkpoint lets the WAL start over, shrink it back from
+        // whatever a burst grew it to.
+        if (read_only) return;
+        exec("PRAGMA journal_size_limit = 67108864;");
+        sqlite3_wal_autocheckpoint(db, 0);
+        sqlite3_wal_hook(db, on_wal_commit, nullptr);
+    }
+
+    ~Database() {
+        for (auto& [sql, stmt] : statements) sqlite3_finalize(stmt);
+        sqlite3_close(db);
+    }
+
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
+
+    // The cached statement for `sql`, prepared on first use. Evaluates to
+    // false if it does not compile. Only one borrower per SQL string at a
+    // time.
+    Statement prepare(const std::string& sql) {
+        auto it = statements.find(sql);
+        if (it != statements.end()) return Statement(it->second);
+
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK) {
+            std::cerr << "[DB] " << sqlite3_errmsg(db) << " in: " << sql << std::endl;
+            return Statement();
+        }
+        statements.emplace(sql, stmt);
+        return Statement(stmt);
+    }
+
+    // One-off SQL (schema, pragmas); not cached.
+    bool exec(const char* sql) {
+        char* error = nullptr;
+        if (sqlite3_exec(db, sql, nullptr, nullptr, &error) == SQLITE_OK) return true;
+        std::cerr << "[DB] " << (error ? error : "error") << " in: " << sql << std::endl;
+        sqlite3_free(error);
+        return false;
+    }
+
+    int64_t last_insert_rowid() const { return sqlite3_last_insert_rowid(db); }
+    sqlite3* handle() const { return db; }
+
+private:
+    sqlite3* db = nullptr;
+    std::unordered_map<std::string, sqlite3_stmt*> statements;
+
+    static int on_wal_commit(void*, sqlite3*, const char*, int pages) {
+        if (pages >= database_options.checkpoint_pages) checkpointer.request();
+        return SQLITE_OK;
+    }
+};
+
+inline void Checkpointer::run(const std::string& path, std::chrono::seconds interval) {
+    Database db(path);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, interval, [&] { return pending; });
+            pending = false;
+        }
+        // PASSIVE never blocks the workers. Once it has copied every frame,
+        // the next commit starts the WAL over from the beginning.
+        int log_frames = 0, checkpointed = 0;
+        if (sqlite3_wal_checkpoint_v2(db.handle(), nullptr, SQLITE_CHECKPOINT_PASSIVE, &log_frames, &checkpointed) == SQLITE_OK) {
+            ++metrics.db_checkpoints;
+            metrics.db_wal_frames = log_frames - checkpointed;
+        }
+    }
+}
+
+inline const char* const database_path = "termicomm_server.db";
+
+// This thread's connection, opened on first use.
+inline Database& local_db() {
+    thread_local Database db(database_path);
+    return db;
+}
+
+// Read-only connections for history and search. A read borrows one for
+// the length of a Snapshot: one WAL read transaction, so every query in it
+// sees the same committed state, while writers go on committing on their
+// own connections. Neither side ever waits on the other's lock.
+class ReadPool {
+public:
+    class Snapshot {
+    public:
+        Snapshot(ReadPool& pool, Database* db) : pool(&pool), db(db) { db->exec("BEGIN;"); }
+        Snapshot(Snapshot&& other) noexcept : pool(other.pool), db(std::exchange(other.db, nullptr)) {}
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        ~Snapshot() {
+            if (!db) return;
+            db->exec("COMMIT;");
+            pool->release(db);
+        }
+
+        Database& operator*() const { return *db; }
+        Database* operator->() const { return db; }
+
+    private:
+        ReadPool* pool;
+        Database* db;
+    };
+
+    // Call before any worker reads.
+    void open(const std::string& path, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < std::max<size_t>(1, size); ++i) {
+            connections.push_back(std::make_unique<Database>(path, true));
+            idle.push_back(connections.back().get());
+        }
+    }
+
+    // Waits for a free connection if every one is in use.
+    Snapshot snapshot() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (idle.empty()) {
+            ++metrics.db_read_waits;
+            available.wait(lock, [&] { return !idle.empty(); });
+        }
+        Database* db = idle.back();
+        idle.pop_back();
+        lock.unlock();
+        return Snapshot(*this, db);
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<std::unique_ptr<Database>> connections;
+    std::vector<Database*> idle;
+
+    void release(Database* db) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(db);
+        }
+        available.notify_one();
+    }
+};
+
+inline ReadPool read_pool;
+
+#endif // DATABASE_HPP
@@ -0,0 +1,106 @@
+#ifndef GUILD_TREE_HPP
+#define GUILD_TREE_HPP
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../include/json.hpp"
+#include "database.hpp"
+#include "reactor.hpp"
+
+// The guild/channel tree every login starts from. Loaded once at startup
+// and then patched in place by OP 7 and OP 8, so logins never query it.
+// The OP 9 payload is built once per change and shared, per encoding, by
+// every login until the next one.
+class GuildTree {
+public:
+    struct Snapshot {
+        std::shared_ptr<const Broadcast> payload;  // the OP 9 frame
+        std::vector<int> channel_ids;
+    };
+
+    void load(Database& db) {
+        Statement rows = db.prepare(
+            "SELECT g.id, g.name, c.id, c.name FROM guilds g LEFT JOIN channels c ON c.guild_id = g.id ORDER BY g.id, c.id;");
+        if (!rows) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        guilds.clear();
+        guild_by_channel.clear();
+        while (rows.next()) {
+            int guild_id = rows.column_int(0);
+            if (guilds.empty() || guilds.back().id != guild_id) guilds.push_back({guild_id, rows.column_text(1), {}});
+            if (rows.column_null(2)) continue;
+            guilds.back().channels.push_back({rows.column_int(2), rows.column_text(3)});
+            guild_by_channel[rows.column_int(2)] = guild_id;
+        }
+        cached.reset();
+    }
+
+    void add_guild(int id, std::string name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        guilds.push_back({id, std::move(name), {}});
+        cached.reset();
+    }
+
+    // Channels of a guild we don't know about are not part of the tree.
+    void add_channel(int id, int guild_id, std::string name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& guild : guilds) {
+            if (guild.id != guild_id) continue;
+            guild.channels.push_back({id, std::move(name)});
+            guild_by_channel[id] = guild_id;
+            cached.reset();
+            return;
+        }
+    }
+
+    // The guild a channel belongs to, 0 if it is not in the tree.
+    int guild_of(int channel_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = guild_by_channel.find(channel_id);
+        return it != guild_by_channel.end() ? it->second : 0;
+    }
+
+    std::shared_ptr<const Snapshot> snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cached) return cached;
+
+        auto built = std::make_shared<Snapshot>();
+        nlohmann::json tree = nlohmann::json::array();
+        for (auto& guild : guilds) {
+            nlohmann::json channels = nlohmann::json::array();
+            for (auto& channel : guild.channels) {
+                channels.push_back({{"id", channel.id}, {"name", channel.name}});
+                built->channel_ids.push_back(channel.id);
+            }
+            tree.push_back({{"id", guild.id}, {"name", guild.name}, {"channels", std::move(channels)}});
+        }
+        built->payload = std::make_shared<const Broadcast>(nlohmann::json{{"op", 9}, {"d", std::move(tree)}});
+        cached = std::move(built);
+        return cached;
+    }
+
+private:
+    struct ChannelNode {
+        int id;
+        std::string name;
+    };
+
+    struct GuildNode {
+        int id;
+        std::string name;
+        std::vector<ChannelNode> channels;
+    };
+
+    std::mutex mutex;
+    std::vector<GuildNode> guilds;
+    std::unordered_map<int, int> guild_by_channel;  // for guild_of(), which routes every stored message
+    std::shared_ptr<const Snapshot> cached;  // null until the next login after a change
+};
+
+inline GuildTree guild_tree;
+
+#endif // GUILD_TREE_HPP
@@ -0,0 +1,369 @@
+#ifndef MESSAGE_LOG_HPP
+#define MESSAGE_LOG_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "message_store.hpp"
+
+// A MessageStore that appends each channel's messages to its own log of
+// fixed-size, mmap'd segment files, `<directory>/<channel>/<first id>.log`.
+// Appends are a memcpy into the mapping plus one msync per segment per
+// batch; there is no B-tree, journal or page cache to go through. Each
+// segment keeps a sparse in-memory index, one entry per `index_interval`
+// records, that reads binary-search and then scan from.
+//
+// Nothing is ever rewritten. On startup every segment is scanned once; a
+// torn record (bad size or checksum) ends the log there, and any later
+// segment files are renamed to `.log.quarantine` rather than loaded.
+class LogMessageStore : public MessageStore {
+public:
+    LogMessageStore(std::string log_directory, size_t segment_bytes)
+        : directory(std::move(log_directory)), segment_bytes(std::max<size_t>(segment_bytes, 1 << 16)) {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        recover();
+    }
+
+    ~LogMessageStore() override {
+        for (auto& [channel_id, log] : channels) {
+            for (auto& segment : log->segments) munmap(segment->data, segment->capacity);
+        }
+    }
+
+    // Durable once every touched segment is msync'd. Records only become
+    // visible to readers after that, and only the ones that synced: a
+    // segment that fails is rolled back, along with whatever this batch
+    // wrote to its channel after it, so what a channel shows stays a prefix
+    // of the batch and a retry can skip exactly what is already stored.
+    bool append(const std::vector<ChannelMessage>& batch) override {
+        struct Touched {
+            ChannelLog* log;
+            Segment* segment;
+            size_t from;     // where this batch started writing in it
+            size_t records;  // and its record count then
+        };
+        std::map<Segment*, size_t> dirty;  // segment -> its entry in touched
+        std::vector<Touched> touched;
+        bool synced = true;
+        for (auto& row : batch) {
+            ChannelLog& log = channel(row.channel_id);
+            Segment* segment = writable_segment(log, row.message.id, record_size(row.message));
+            if (!segment) {
+                synced = false;
+                break;
+            }
+            if (dirty.emplace(segment, touched.size()).second) touched.push_back({&log, segment, segment->written, segment->records});
+            write_record(*segment, row.message);
+        }
+
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        std::set<ChannelLog*> failed;
+        for (auto& [log, segment, from, records] : touched) {
+            size_t start = from / page * page;
+            if (!failed.count(log) && msync(segment->data + start, segment->written - start, MS_SYNC) == 0) {
+                std::unique_lock<std::shared_mutex> lock(log->mutex);
+                publish(*segment);
+                continue;
+            }
+            // Zero what may have partly reached the disk, so a restart
+            // doesn't bring back messages reported lost.
+            failed.insert(log);
+            synced = false;
+            std::memset(segment->data + from, 0, segment->written - from);
+            msync(segment->data + start, segment->written - start, MS_SYNC);
+            segment->written = from;
+            segment->records = records;
+            segment->pending_index.clear();
+            segment->pending_last_id = segment->last_id;
+        }
+        return synced;
+    }
+
+    void read_before(int channel_id, int64_t before, size_t count, std::vector<StoredMessage>& out) override {
+        ChannelLog* log = find(channel_id);
+        if (!log) return;
+        std::shared_lock<std::shared_mutex> lock(log->mutex);
+        auto& segments = log->segments;
+        for (size_t s = segments.size(); s-- > 0 && count > 0;) {
+            const Segment& segment = *segments[s];
+            if (segment.first_id >= before || segment.index.empty()) continue;
+
+            // Walk the index blocks that can hold ids below `before`, newest
+            // first, scanning each block forward and emitting it backwards.
+            auto block = std::lower_bound(segment.index.begin(), segment.index.end(), before,
+                                          [](const IndexEntry& entry, int64_t id) { return entry.id < id; });
+            std::vector<StoredMessage> scanned;
+            while (block != segment.index.begin() && count > 0) {
+                --block;
+                size_t end = block + 1 != segment.index.end() ? (block + 1)->offset : segment.end;
+                scanned.clear();
+                for (size_t at = block->offset; at < end;) {
+                    StoredMessage message;
+                    at = read_record(segment, at, message);
+                    if (message.id >= before) break;
+                    scanned.push_back(std::move(message));
+                }
+                for (auto it = scanned.rbegin(); it != scanned.rend() && count > 0; ++it, --count) out.push_back(std::move(*it));
+            }
+        }
+    }
+
+    void read_after(int channel_id, int64_t after, size_t count, std::vector<StoredMessage>& out) override {
+        ChannelLog* log = find(channel_id);
+        if (!log) return;
+        std::shared_lock<std::shared_mutex> lock(log->mutex);
+        for (auto& segment : log->segments) {
+            if (count == 0) break;
+            if (segment->last_id <= after || segment->index.empty()) continue;
+
+            // Start from the last indexed record at or before `after`.
+            auto block = std::upper_bound(segment->index.begin(), segment->index.end(), after,
+                                          [](int64_t id, const IndexEntry& entry) { return id < entry.id; });
+            size_t at = block == segment->index.begin() ? 0 : std::prev(block)->offset;
+            while (at < segment->end && count > 0) {
+                StoredMessage message;
+                at = read_record(*segment, at, message);
+                if (message.id <= after) continue;
+                out.push_back(std::move(message));
+                --count;
+            }
+        }
+    }
+
+    int64_t last_id() override { return newest_id.load(); }
+
+private:
+    // Every record: this header, the author, the content, then padding to
+    // 8 bytes. The checksum covers everything after it.
+    struct RecordHeader {
+        uint32_t size;  // whole record, padded; 0 past the last one
+        uint32_t checksum;
+        int64_t id;
+        uint32_t author_size;
+        uint32_t content_size;
+    };
+
+    struct IndexEntry {
+        int64_t id;
+        size_t offset;
+    };
+
+    struct Segment {
+        int64_t first_id = 0;
+        int64_t last_id = 0;
+        char* data = nullptr;
+        size_t capacity = 0;
+        size_t end = 0;       // readers stop here; advanced once a batch is synced
+        size_t written = 0;   // the writer's position, ahead of `end` mid-batch
+        size_t records = 0;
+        std::vector<IndexEntry> index;
+        std::vector<IndexEntry> pending_index;  // index entries for records not yet published
+        int64_t pending_last_id = 0;
+    };
+
+    struct ChannelLog {
+        int channel_id;
+        std::shared_mutex mutex;  // segment list and published positions
+        std::vector<std::unique_ptr<Segment>> segments;
+    };
+
+    static constexpr size_t index_interval = 64;
+
+    std::string directory;
+    size_t segment_bytes;
+    std::atomic<int64_t> newest_id{0};
+
+    std::shared_mutex channels_mutex;
+    std::map<int, std::unique_ptr<ChannelLog>> channels;
+
+    static size_t record_size(const StoredMessage& message) {
+        return (sizeof(RecordHeader) + message.author.size() + message.content.size() + 7) / 8 * 8;
+    }
+
+    static uint32_t checksum(const char* data, size_t size) {
+        return static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size)));
+    }
+
+    ChannelLog* find(int channel_id) {
+        std::shared_lock<std::shared_mutex> lock(channels_mutex);
+        auto it = channels.find(channel_id);
+        return it != channels.end() ? it->second.get() : nullptr;
+    }
+
+    ChannelLog& channel(int channel_id) {
+        if (ChannelLog* log = find(channel_id)) return *log;
+        std::unique_lock<std::shared_mutex> lock(channels_mutex);
+        auto& log = channels[channel_id];
+        if (!log) {
+            log = std::make_unique<ChannelLog>();
+            log->channel_id = channel_id;
+        }
+        return *log;
+    }
+
+    // The segment `size` more bytes go to, opening a new one when the last
+    // is full. Only the writer thread calls this.
+    Segment* writable_segment(ChannelLog& log, int64_t id, size_t size) {
+        if (!log.segments.empty() && log.segments.back()->capacity - log.segments.back()->written >= size + sizeof(uint32_t)) {
+            return log.segments.back().get();
+        }
+        std::string channel_directory = directory + "/" + std::to_string(log.channel_id);
+        std::error_code error;
+        std::filesystem::create_directories(channel_directory, error);
+
+        auto segment = map_segment(channel_directory + "/" + std::to_string(id) + ".log", std::max(segment_bytes, size + sizeof(uint32_t)), true);
+        if (!segment) return nullptr;
+        segment->first_id = id;
+        std::unique_lock<std::shared_mutex> lock(log.mutex);
+        log.segments.push_back(std::move(segment));
+        return log.segments.back().get();
+    }
+
+    void write_record(Segment& segment, const StoredMessage& message) {
+        size_t size = record_size(message);
+        char* at = segment.data + segment.written;
+        RecordHeader header{static_cast<uint32_t>(size), 0, message.id, static_cast<uint32_t>(message.author.size()),
+                            static_cast<uint32_t>(message.content.size())};
+        std::memcpy(at + sizeof(RecordHeader), message.author.data(), message.author.size());
+        std::memcpy(at + sizeof(RecordHeader) + message.author.size(), message.content.data(), message.content.size());
+        std::memcpy(at, &header, sizeof(header));
+        header.checksum = checksum(at + 2 * sizeof(uint32_t), size - 2 * sizeof(uint32_t));
+        std::memcpy(at + sizeof(uint32_t), &header.checksum, sizeof(header.checksum));
+
+        if (segment.records++ % index_interval == 0) segment.pending_index.push_back({message.id, segment.written});
+        segment.pending_last_id = message.id;
+        segment.written += size;
+    }
+
+    // Make what the writer has written visible. Caller holds the log's lock.
+    void publish(Segment& segment) {
+        segment.index.insert(segment.index.end(), segment.pending_index.begin(), segment.pending_index.end());
+        segment.pending_index.clear();
+        segment.end = segment.written;
+        segment.last_id = segment.pending_last_id;
+        int64_t newest = newest_id.load();
+        while (segment.last_id > newest && !newest_id.compare_exchange_weak(newest, segment.last_id)) {}
+    }
+
+    static size_t read_record(const Segment& segment, size_t at, StoredMessage& message) {
+        RecordHeader header;
+        std::memcpy(&header, segment.data + at, sizeof(header));
+        const char* body = segment.data + at + sizeof(RecordHeader);
+        message.id = header.id;
+        message.author.assign(body, header.author_size);
+        message.content.assign(body + header.author_size, header.content_size);
+        return at + header.size;
+    }
+
+    std::unique_ptr<Segment> map_segment(const std::string& path, size_t capacity, bool create) {
+        int fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDWR | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "[LOG] Could not open " << path << std::endl;
+            return nullptr;
+        }
+        if (create && ftruncate(fd, static_cast<off_t>(capacity)) != 0) capacity = 0;
+        if (!create) capacity = static_cast<size_t>(lseek(fd, 0, SEEK_END));
+        void* data = capacity ? mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::cerr << "[LOG] Could not map " << path << std::endl;
+            return nullptr;
+        }
+        auto segment = std::make_unique<Segment>();
+        segment->data = static_cast<char*>(data);
+        segment->capacity = capacity;
+        return segment;
+    }
+
+    // Load every channel's segments and rebuild their indexes.
+    void recover() {
+        std::error_code error;
+        for (auto& channel_entry : std::filesystem::directory_iterator(directory, error)) {
+            int channel_id;
+            try {
+                channel_id = std::stoi(channel_entry.path().filename().string());
+            } catch (const std::exception&) {
+                continue;
+            }
+
+            std::map<int64_t, std::filesystem::path> files;
+            for (auto& file : std::filesystem::directory_iterator(channel_entry.path(), error)) {
+                if (file.path().extension() != ".log") continue;
+                try {
+                    files.emplace(std::stoll(file.path().stem().string()), file.path());
+                } catch (const std::exception&) {}
+            }
+
+            auto log = std::make_unique<ChannelLog>();
+            log->channel_id = channel_id;
+            int64_t previous = 0;
+            bool broken = false;
+            for (auto& [first_id, path] : files) {
+                if (!broken) {
+                    if (auto segment = map_segment(path.string(), 0, false)) {
+                        segment->first_id = first_id;
+                        broken = !scan(*segment, previous);
+                        log->segments.push_back(std::move(segment));
+                        continue;
+                    }
+                    broken = true;
+                }
+                quarantine(path);
+            }
+            channels.emplace(channel_id, std::move(log));
+        }
+    }
+
+    // Set aside a segment past where the log broke. Appends continue from
+    // the break with ids it may already hold, so loading it now or on a
+    // later restart would interleave the two.
+    static void quarantine(const std::filesystem::path& path) {
+        std::error_code error;
+        std::filesystem::rename(path, path.string() + ".quarantine", error);
+        if (error) std::cerr << "[LOG] Could not set aside " << path.string() << std::endl;
+        else std::cerr << "[LOG] Set aside " << path.string() << " as .quarantine" << std::endl;
+    }
+
+    // Index a segment's records. False if it ended in a torn record, which
+    // is zeroed so the next append overwrites it.
+    bool scan(Segment& segment, int64_t& previous) {
+        size_t at = 0;
+        bool intact = true;
+        while (segment.capacity - at >= sizeof(RecordHeader)) {
+            RecordHeader header;
+            std::memcpy(&header, segment.data + at, sizeof(header));
+            if (header.size == 0) break;
+            if (header.size < sizeof(RecordHeader) || header.size > segment.capacity - at || header.id <= previous ||
+                sizeof(RecordHeader) + size_t(header.author_size) + header.content_size > header.size ||
+                checksum(segment.data + at + 2 * sizeof(uint32_t), header.size - 2 * sizeof(uint32_t)) != header.checksum) {
+                std::memset(segment.data + at, 0, segment.capacity - at);
+                intact = false;
+                break;
+            }
+            if (segment.records++ % index_interval == 0) segment.pending_index.push_back({header.id, at});
+            segment.pending_last_id = previous = header.id;
+            at += header.size;
+        }
+        segment.written = at;
+        publish(segment);
+        return intact;
+    }
+};
+
+#endif // MESSAGE_LOG_HPP
@@ -0,0 +1,132 @@
+#ifndef MESSAGE_STORE_HPP
+#define MESSAGE_STORE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "archive.hpp"
+#include "database.hpp"
+
+// A message on its way into a store.
+struct ChannelMessage {
+    int channel_id;
+    StoredMessage message;
+};
+
+// Where chat messages live. Appends come only from the MessageWriter
+// thread; reads come from any worker, concurrently with appends.
+class MessageStore {
+public:
+    virtual ~MessageStore() = default;
+
+    // Make a batch durable; false if any of it may not be. Ids ascend
+    // within a channel.
+    virtual bool append(const std::vector<ChannelMessage>& batch) = 0;
+
+    // Up to `count` messages of `channel_id` older than `before`, newest
+    // first, appended to `out`.
+    virtual void read_before(int channel_id, int64_t before, size_t count, std::vector<StoredMessage>& out) = 0;
+
+    // Up to `count` messages of `channel_id` newer than `after`, oldest
+    // first, appended to `out`.
+    virtual void read_after(int channel_id, int64_t after, size_t count, std::vector<StoredMessage>& out) = 0;
+
+    // The highest id stored, 0 if none.
+    virtual int64_t last_id() = 0;
+};
+
+// The messages table, plus the archive segments the compactor has moved
+// out of it. Writes go through the writer thread's own connection; reads
+// take one snapshot from read_pool.
+class SqliteMessageStore : public MessageStore {
+public:
+    bool append(const std::vector<ChannelMessage>& batch) override {
+        Database& db = local_db();
+        if (!db.exec("BEGIN IMMEDIATE;")) return false;
+        bool written = true;
+        for (auto& row : batch) {
+            Statement insert = db.prepare("INSERT INTO messages (id, channel_id, author_name, content, timestamp) VALUES (?, ?, ?, ?, datetime('now'));");
+            written = insert && insert.bind(1, row.message.id).bind(2, row.channel_id).bind(3, row.message.author).bind(4, row.message.content).exec();
+            if (!written) break;
+        }
+        if (!written || !db.exec("COMMIT;")) {
+            db.exec("ROLLBACK;");
+            return false;
+        }
+        return true;
+    }
+
+    // The table, then the archive behind it, in one snapshot so an archive
+    // pass can't move rows out from under the read. A channel's archive is
+    // always older than its rows in the table.
+    void read_before(int channel_id, int64_t before, size_t count, std::vector<StoredMessage>& out) override {
+        ReadPool::Snapshot snapshot = read_pool.snapshot();
+        size_t wanted = out.size() + count;
+        if (Statement page = snapshot->prepare("SELECT id, author_name, content FROM messages WHERE channel_id = ? AND id < ? ORDER BY id DESC LIMIT ?;")) {
+            page.bind(1, channel_id).bind(2, before).bind(3, static_cast<int64_t>(count));
+            while (page.next()) out.push_back({page.column_int64(0), page.column_text(1), page.column_text(2)});
+        }
+        if (out.size() < wanted) archive.read_before(*snapshot, channel_id, out.empty() ? before : std::min(before, out.back().id), wanted - out.size(), out);
+    }
+
+    void read_after(int channel_id, int64_t after, size_t count, std::vector<StoredMessage>& out) override {
+        ReadPool::Snapshot snapshot = read_pool.snapshot();
+        size_t wanted = out.size() + count;
+        archive.read_after(*snapshot, channel_id, after, count, out);
+        if (out.size() >= wanted) return;
+        if (Statement page = snapshot->prepare("SELECT id, author_name, content FROM messages WHERE channel_id = ? AND id > ? ORDER BY id ASC LIMIT ?;")) {
+            page.bind(1, channel_id).bind(2, out.empty() ? after : std::max(after, out.back().id)).bind(3, static_cast<int64_t>(wanted - out.size()));
+            while (page.next()) out.push_back({page.column_int64(0), page.column_text(1), page.column_text(2)});
+        }
+    }
+
+    // Archived ids count too: the table may have been emptied into segments.
+    int64_t last_id() override {
+        ReadPool::Snapshot snapshot = read_pool.snapshot();
+        Statement newest = snapshot->prepare(
+            "SELECT MAX((SELECT COALESCE(MAX(id), 0) FROM messages), (SELECT COALESCE(MAX(last_id), 0) FROM archive_segments));");
+        return newest && newest.next() ? newest.column_int64(0) : 0;
+    }
+};
+
+// Sends each channel to one of two stores, e.g. the message log for
+// write-heavy guilds and SQLite for the rest. A channel should not move
+// between them: history written to the other one stays there.
+class RoutedMessageStore : public MessageStore {
+public:
+    using Route = std::function<bool(int channel_id)>;  // true: `routed`, false: `fallback`
+
+    RoutedMessageStore(std::unique_ptr<MessageStore> fallback, std::unique_ptr<MessageStore> routed, Route route)
+        : fallback(std::move(fallback)), routed(std::move(routed)), route(std::move(route)) {}
+
+    bool append(const std::vector<ChannelMessage>& batch) override {
+        std::vector<ChannelMessage> to_fallback, to_routed;
+        for (auto& row : batch) (route(row.channel_id) ? to_routed : to_fallback).push_back(row);
+        // Not atomic across the two stores: each half is all or nothing.
+        bool written = to_routed.empty() || routed->append(to_routed);
+        return (to_fallback.empty() || fallback->append(to_fallback)) && written;
+    }
+
+    void read_before(int channel_id, int64_t before, size_t count, std::vector<StoredMessage>& out) override {
+        store_for(channel_id).read_before(channel_id, before, count, out);
+    }
+
+    void read_after(int channel_id, int64_t after, size_t count, std::vector<StoredMessage>& out) override {
+        store_for(channel_id).read_after(channel_id, after, count, out);
+    }
+
+    int64_t last_id() override { return std::max(fallback->last_id(), routed->last_id()); }
+
+private:
+    std::unique_ptr<MessageStore> fallback;
+    std::unique_ptr<MessageStore> routed;
+    Route route;
+
+    MessageStore& store_for(int channel_id) { return route(channel_id) ? *routed : *fallback; }
+};
+
+#endif // MESSAGE_STORE_HPP
@@ -0,0 +1,135 @@
+#ifndef MESSAGE_WRITER_HPP
+#define MESSAGE_WRITER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "message_store.hpp"
+#include "metrics.hpp"
+
+// Group commit for chat messages. Workers hand messages to submit() and
+// carry on; one writer thread appends them to the MessageStore in batches,
+// once it has `batch_size` messages or the oldest has waited `max_delay`. Message ids are handed out at submit time, in queue
+// order, so a message can be broadcast with its id before it is written.
+class MessageWriter {
+public:
+    // Runs on the writer thread once the message is durable, or with
+    // `stored` false once the writer has given up on it.
+    using Committed = std::function<void(int64_t id, bool stored)>;
+
+    struct Pending {
+        int64_t id = 0;  // assigned by submit()
+        int channel_id;
+        std::string author;
+        std::string content;
+        Committed on_commit;
+        std::chrono::steady_clock::time_point queued_at{};
+    };
+
+    // Ids start one past the highest one already in `store`.
+    MessageWriter(MessageStore& store, size_t batch_size, std::chrono::microseconds max_delay)
+        : store(store), batch_size(std::max<size_t>(1, batch_size)), max_delay(max_delay), next_id(store.last_id() + 1) {}
+
+    // Thread-safe. Returns the message's id.
+    int64_t submit(Pending message) {
+        message.queued_at = std::chrono::steady_clock::now();
+        int64_t id;
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            id = message.id = next_id++;
+            queue.push_back(std::move(message));
+            wake = queue.size() == 1 || queue.size() == batch_size;
+        }
+        if (wake) ready.notify_one();
+        return id;
+    }
+
+    void run() {
+        std::vector<Pending> batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] { return !queue.empty(); });
+                ready.wait_until(lock, queue.front().queued_at + max_delay, [&] { return queue.size() >= batch_size; });
+
+                size_t count = std::min(queue.size(), batch_size);
+                batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.begin() + count));
+                queue.erase(queue.begin(), queue.begin() + count);
+            }
+            commit(batch);
+            batch.clear();
+        }
+    }
+
+private:
+    MessageStore& store;
+    size_t batch_size;
+    std::chrono::microseconds max_delay;
+
+    static constexpr int max_attempts = 4;  // 50, 200 and 800 ms apart
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Pending> queue;
+    int64_t next_id;
+
+    // A failed append is retried, minus anything the store kept of it, a
+    // few times before the rest of the batch is reported as lost.
+    void commit(std::vector<Pending>& batch) {
+        std::vector<ChannelMessage> rows;
+        rows.reserve(batch.size());
+        for (auto& message : batch) rows.push_back({message.channel_id, {message.id, std::move(message.author), std::move(message.content)}});
+
+        // Whatever is left in `rows` afterwards is lost.
+        auto backoff = std::chrono::milliseconds(50);
+        for (int attempt = 1; !rows.empty(); ++attempt) {
+            if (store.append(rows)) {
+                rows.clear();
+                break;
+            }
+            std::cerr << "[DB] Could not write a batch of " << rows.size() << " messages (attempt " << attempt << ")" << std::endl;
+            drop_stored(rows);
+            if (attempt == max_attempts) break;
+            std::this_thread::sleep_for(backoff);
+            backoff *= 4;
+        }
+
+        std::unordered_set<int64_t> lost;
+        for (auto& row : rows) lost.insert(row.message.id);
+        ++metrics.message_batches;
+        metrics.messages_committed += batch.size() - lost.size();
+        metrics.messages_lost += lost.size();
+        for (auto& message : batch) {
+            if (message.on_commit) message.on_commit(message.id, lost.count(message.id) == 0);
+        }
+    }
+
+    // Drop the rows a failed append stored anyway: a store may keep part of
+    // a batch, and ids only grow within a channel.
+    void drop_stored(std::vector<ChannelMessage>& rows) {
+        std::unordered_map<int, int64_t> newest;
+        std::vector<StoredMessage> last;
+        for (auto& row : rows) {
+            if (newest.count(row.channel_id)) continue;
+            last.clear();
+            store.read_before(row.channel_id, INT64_MAX, 1, last);
+            newest[row.channel_id] = last.empty() ? 0 : last.front().id;
+        }
+        rows.erase(std::remove_if(rows.begin(), rows.end(), [&](const ChannelMessage& row) { return row.message.id <= newest[row.channel_id]; }),
+                   rows.end());
+    }
+};
+
+#endif // MESSAGE_WRITER_HPP
@@ -0,0 +1,54 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// Process-wide counters and gauges. Written from any thread with relaxed
+// atomics and printed periodically by the server.
+struct ServerMetrics {
+    std::atomic<int64_t> connections{0};
+    std::atomic<int64_t> outbound_queued_bytes{0};
+    std::atomic<int64_t> slow_consumers{0};            // connections above the high watermark
+    std::atomic<uint64_t> slow_consumer_disconnects{0};
+    std::atomic<uint64_t> rejected_frames{0};          // unparseable, failed opcode validation, or threw in a handler
+    std::atomic<uint64_t> db_checkpoints{0};
+    std::atomic<int64_t> db_wal_frames{0};             // left in the WAL after the last checkpoint
+    std::atomic<uint64_t> db_read_waits{0};            // reads that found every pooled connection busy
+    std::atomic<uint64_t> message_batches{0};
+    std::atomic<uint64_t> messages_committed{0};
+    std::atomic<uint64_t> messages_lost{0};           // given up on after retries; senders get OP 15
+    std::atomic<uint64_t> history_cache_hits{0};      // pages served from the recent-message rings
+    std::atomic<uint64_t> history_cache_misses{0};
+    std::atomic<uint64_t> messages_archived{0};
+    std::atomic<uint64_t> archive_segment_reads{0};    // segments decompressed for history
+    std::atomic<uint64_t> voice_packets_in{0};
+    std::atomic<uint64_t> voice_packets_out{0};
+    std::atomic<uint64_t> voice_packets_dropped{0};    // from endpoints no hello has bound
+};
+
+inline ServerMetrics metrics;
+
+inline void write_metrics(std::ostream& out) {
+    out << "connections=" << metrics.connections.load(std::memory_order_relaxed)
+        << " outbound_queued_bytes=" << metrics.outbound_queued_bytes.load(std::memory_order_relaxed)
+        << " slow_consumers=" << metrics.slow_consumers.load(std::memory_order_relaxed)
+        << " slow_consumer_disconnects=" << metrics.slow_consumer_disconnects.load(std::memory_order_relaxed)
+        << " rejected_frames=" << metrics.rejected_frames.load(std::memory_order_relaxed)
+        << " db_checkpoints=" << metrics.db_checkpoints.load(std::memory_order_relaxed)
+        << " db_wal_frames=" << metrics.db_wal_frames.load(std::memory_order_relaxed)
+        << " db_read_waits=" << metrics.db_read_waits.load(std::memory_order_relaxed)
+        << " message_batches=" << metrics.message_batches.load(std::memory_order_relaxed)
+        << " messages_committed=" << metrics.messages_committed.load(std::memory_order_relaxed)
+        << " messages_lost=" << metrics.messages_lost.load(std::memory_order_relaxed)
+        << " history_cache_hits=" << metrics.history_cache_hits.load(std::memory_order_relaxed)
+        << " history_cache_misses=" << metrics.history_cache_misses.load(std::memory_order_relaxed)
+        << " messages_archived=" << metrics.messages_archived.load(std::memory_order_relaxed)
+        << " archive_segment_reads=" << metrics.archive_segment_reads.load(std::memory_order_relaxed)
+        << " voice_packets_in=" << metrics.voice_packets_in.load(std::memory_order_relaxed)
+        << " voice_packets_out=" << metrics.voice_packets_out.load(std::memory_order_relaxed)
+        << " voice_packets_dropped=" << metrics.voice_packets_dropped.load(std::memory_order_relaxed);
+}
+
+#endif // METRICS_HPP
@@ -0,0 +1,78 @@
+#ifndef MIGRATIONS_HPP
+#define MIGRATIONS_HPP
+
+#include <iostream>
+#include <string>
+#include "database.hpp"
+
+// Schema changes, applied in order. Each runs once, in its own
+// transaction, and is recorded in schema_version. Append new ones; never
+// edit one that has shipped.
+struct Migration {
+    int version;
+    const char* description;
+    const char* sql;
+};
+
+inline const Migration migrations[] = {
+    {1, "base schema",
+     "CREATE TABLE IF NOT EXISTS users (username TEXT PRIMARY KEY, password TEXT);"
+     "CREATE TABLE IF NOT EXISTS messages (id INTEGER PRIMARY KEY, channel_id INTEGER, author_name TEXT, content TEXT, timestamp DATETIME);"
+     "CREATE TABLE IF NOT EXISTS guilds (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT);"
+     "CREATE TABLE IF NOT EXISTS channels (id INTEGER PRIMARY KEY AUTOINCREMENT, guild_id INTEGER, name TEXT);"
+     "INSERT OR IGNORE INTO guilds (id, name) VALUES (1, 'General Lobby');"
+     "INSERT OR IGNORE INTO channels (id, guild_id, name) VALUES (1, 1, 'general');"},
+    {2, "index messages by channel and channels by guild",
+     "CREATE INDEX IF NOT EXISTS messages_channel_id ON messages (channel_id, id);"
+     "CREATE INDEX IF NOT EXISTS channels_guild_id ON channels (guild_id);"},
+    {3, "full-text index on message content",
+     "CREATE VIRTUAL TABLE IF NOT EXISTS messages_fts USING fts5(content, content='messages', content_rowid='id', tokenize='unicode61 remove_diacritics 2');"
+     "CREATE TRIGGER IF NOT EXISTS messages_fts_insert AFTER INSERT ON messages BEGIN"
+     "  INSERT INTO messages_fts (rowid, content) VALUES (new.id, new.content);"
+     " END;"
+     "CREATE TRIGGER IF NOT EXISTS messages_fts_delete AFTER DELETE ON messages BEGIN"
+     "  INSERT INTO messages_fts (messages_fts, rowid, content) VALUES ('delete', old.id, old.content);"
+     " END;"
+     "CREATE TRIGGER IF NOT EXISTS messages_fts_update AFTER UPDATE OF content ON messages BEGIN"
+     "  INSERT INTO messages_fts (messages_fts, rowid, content) VALUES ('delete', old.id, old.content);"
+     "  INSERT INTO messages_fts (rowid, content) VALUES (new.id, new.content);"
+     " END;"
+     "INSERT INTO messages_fts (messages_fts) VALUES ('rebuild');"},
+    {4, "archive segment index",
+     "CREATE TABLE IF NOT EXISTS archive_segments (channel_id INTEGER, first_id INTEGER, last_id INTEGER, count INTEGER, file TEXT);"
+     "CREATE INDEX IF NOT EXISTS archive_segments_range ON archive_segments (channel_id, last_id);"},
+};
+
+inline int schema_version(Database& db) {
+    Statement current = db.prepare("SELECT COALESCE(MAX(version), 0) FROM schema_version;");
+    return current && current.next() ? current.column_int(0) : 0;
+}
+
+// Bring the database up to the latest version. False if a migration
+// failed; that migration is rolled back and nothing after it runs.
+inline bool migrate(Database& db) {
+    if (!db.exec("CREATE TABLE IF NOT EXISTS schema_version (version INTEGER PRIMARY KEY, description TEXT, applied_at DATETIME);")) return false;
+
+    int current = schema_version(db);
+    for (const Migration& migration : migrations) {
+        if (migration.version <= current) continue;
+
+        std::cout << "[DB] Migrating to version " << migration.version << ": " << migration.description << std::endl;
+        if (!db.exec("BEGIN IMMEDIATE;")) return false;
+        bool applied = db.exec(migration.sql);
+        if (applied) {
+            std::string description = migration.description;
+            Statement record = db.prepare("INSERT INTO schema_version (version, description, applied_at) VALUES (?, ?, datetime('now'));");
+            applied = record && record.bind(1, migration.version).bind(2, description).exec();
+        }
+        if (!applied || !db.exec("COMMIT;")) {
+            db.exec("ROLLBACK;");
+            std::cerr << "[DB] Migration " << migration.version << " failed" << std::endl;
+            return false;
+        }
+        current = migration.version;
+    }
+    return true;
+}
+
+#endif // MIGRATIONS_HPP
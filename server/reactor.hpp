@@ -0,0 +1,489 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../include/codec.hpp"
+#include "../include/framing.hpp"
+#include "metrics.hpp"
+
+// An encoded wire frame (see encode_payload). Immutable once built, so one
+// serialization can sit in any number of outbound queues at once.
+using Frame = std::shared_ptr<const std::string>;
+
+// One payload fanned out to many connections. Each encoding is serialized
+// the first time a recipient needs it and then shared by every other
+// recipient on that encoding, whichever reactor they live on.
+class Broadcast {
+public:
+    explicit Broadcast(nlohmann::json payload) : payload(std::move(payload)) {}
+
+    const Frame& frame(Encoding encoding) const {
+        size_t i = static_cast<size_t>(encoding);
+        std::call_once(encoded[i], [&] { frames[i] = std::make_shared<const std::string>(encode_payload(payload, encoding)); });
+        return frames[i];
+    }
+
+private:
+    nlohmann::json payload;
+    mutable std::once_flag encoded[encoding_count];
+    mutable Frame frames[encoding_count];
+};
+
+// Frames waiting for the kernel. `offset` is how much of the front frame
+// has already been written.
+struct OutboundQueue {
+    std::deque<Frame> frames;
+    size_t offset = 0;
+    size_t bytes = 0;
+};
+
+// Backpressure policy. Above the high watermark a connection stops being
+// read until its queue drains below the low watermark; one that stays
+// stalled for too long, or keeps growing past the hard limit, is dropped.
+struct OutboundLimits {
+    size_t high_watermark = 4 * 1024 * 1024;
+    size_t low_watermark = 1024 * 1024;
+    size_t hard_limit = 16 * 1024 * 1024;
+    std::chrono::seconds stall_timeout{30};
+};
+
+class Reactor;
+struct Connection;
+
+// Generates a long reply a piece at a time: each call queues the next
+// frame(s) and returns false once there is nothing left.
+using Producer = std::function<bool(Reactor&, Connection&)>;
+
+// One gateway socket. Owned by exactly one Reactor and only ever touched
+// from that reactor's thread.
+struct Connection {
+    int fd = -1;
+    uint64_t id = 0;
+    std::string username = "Unknown";
+    bool identified = false;
+    Encoding encoding = Encoding::json;
+    FrameBuffer inbound;
+    OutboundQueue outbound;
+    bool throttled = false;
+    std::chrono::steady_clock::time_point throttled_since;
+    bool closing = false;
+    std::deque<Producer> producers;  // run in order, as the socket drains
+    bool pumping = false;
+
+    virtual ~Connection() = default;
+};
+
+inline std::atomic<uint64_t> next_connection_id{1};
+
+inline thread_local Reactor* this_reactor = nullptr;
+
+// One event loop. Each reactor owns a set of connections end to end
+// (accept, read, write, close); other threads reach it only through
+// fanout(). Framing, outbound queues and backpressure live here; the
+// subclasses only move bytes between sockets and those buffers.
+class Reactor {
+public:
+    std::function<void(Reactor&, Connection&, std::string_view)> on_frame;
+    std::function<void(Reactor&, Connection&)> on_close;
+    OutboundLimits limits;
+
+    explicit Reactor(int listen_fd) : listen_fd(listen_fd) {
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+    }
+
+    virtual ~Reactor() {
+        for (auto& [fd, conn] : connections) close(fd);
+        close(wake_fd);
+    }
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    virtual void run() = 0;
+
+    // Whole-file I/O for the upload and download ops, on the calling
+    // reactor's thread.
+    virtual bool read_file(const std::string& path, std::string& out) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
+        out.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    virtual bool write_file(const std::string& path, const std::string& data) {
+        std::ofstream outfile(path, std::ios::binary);
+        if (!outfile.is_open()) return false;
+        return static_cast<bool>(outfile << data);
+    }
+
+    // Thread-safe. Queue `message` to every identified connection on this
+    // reactor except `ignore_id`, each in its own encoding. From the
+    // reactor's own thread it is delivered immediately; from other shards it
+    // lands in a batched inbox that costs one wakeup however many messages
+    // pile up in it.
+    void fanout(const std::shared_ptr<const Broadcast>& message, uint64_t ignore_id = 0) {
+        if (this_reactor == this) {
+            deliver(*message, ignore_id);
+            return;
+        }
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(inbox_mutex);
+            wake = fanouts.empty();
+            fanouts.push_back({message, ignore_id});
+        }
+        if (wake) notify();
+    }
+
+    // Queue a frame for a connection owned by this reactor and push as much
+    // as the socket will take right now. Never blocks.
+    void send(Connection& conn, const Frame& frame) {
+        if (conn.closing) return;
+        OutboundQueue& queue = conn.outbound;
+        if (queue.bytes > limits.high_watermark && queue.bytes + frame->size() > limits.hard_limit) {
+            drop_slow_consumer(conn);
+            return;
+        }
+
+        bool was_idle = queue.bytes == 0;
+        queue.frames.push_back(frame);
+        queue.bytes += frame->size();
+        metrics.outbound_queued_bytes += frame->size();
+        if (was_idle) flush(conn);
+
+        if (!conn.closing && !conn.throttled && queue.bytes > limits.high_watermark) {
+            conn.throttled = true;
+            conn.throttled_since = std::chrono::steady_clock::now();
+            ++throttled_count;
+            ++metrics.slow_consumers;
+            on_throttled(conn);
+        }
+    }
+
+    // Send a long reply without buffering all of it: `producer` is called
+    // whenever the connection's queue is under the low watermark, so it
+    // runs as fast as the peer reads and no faster.
+    void stream(Connection& conn, Producer producer) {
+        if (conn.closing) return;
+        conn.producers.push_back(std::move(producer));
+        pump(conn);
+    }
+
+protected:
+    struct Fanout {
+        std::shared_ptr<const Broadcast> message;
+        uint64_t ignore_id;
+    };
+
+    int listen_fd;
+    int wake_fd;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::vector<int> closing_fds;
+    size_t throttled_count = 0;
+
+    std::mutex inbox_mutex;
+    std::vector<Fanout> fanouts;
+
+    virtual std::unique_ptr<Connection> create_connection() { return std::make_unique<Connection>(); }
+
+    // Start (or continue) pushing the outbound queue to the socket.
+    virtual void flush(Connection& conn) = 0;
+    virtual void on_throttled(Connection&) {}
+    // The queue fell back under the low watermark; start reading again.
+    virtual void on_drained(Connection& conn) = 0;
+    // Detach the socket from the backend and close it.
+    virtual void release(std::unique_ptr<Connection> conn) = 0;
+
+    Connection& adopt(int fd) {
+        auto conn = create_connection();
+        conn->fd = fd;
+        conn->id = next_connection_id++;
+        Connection& ref = *conn;
+        connections.emplace(fd, std::move(conn));
+        ++metrics.connections;
+        return ref;
+    }
+
+    // Hand every complete inbound frame to on_frame. A throttled connection
+    // keeps its frames buffered until it drains.
+    void dispatch(Connection& conn) {
+        std::string_view frame;
+        while (!conn.closing && !conn.throttled && conn.inbound.next_frame(frame)) on_frame(*this, conn, frame);
+        if (conn.inbound.overflowed()) mark_closing(conn);
+    }
+
+    // The kernel took `sent` bytes from the front of the queue.
+    void wrote(Connection& conn, size_t sent) {
+        OutboundQueue& queue = conn.outbound;
+        queue.bytes -= sent;
+        metrics.outbound_queued_bytes -= sent;
+        while (sent) {
+            size_t left = queue.frames.front()->size() - queue.offset;
+            if (sent < left) {
+                queue.offset += sent;
+                break;
+            }
+            sent -= left;
+            queue.offset = 0;
+            queue.frames.pop_front();
+        }
+
+        if (conn.throttled && queue.bytes <= limits.low_watermark) {
+            conn.throttled = false;
+            --throttled_count;
+            --metrics.slow_consumers;
+            on_drained(conn);
+        }
+        if (!conn.producers.empty() && queue.bytes < limits.low_watermark) pump(conn);
+    }
+
+    // Fill `iov` with the front of the queue, resuming mid-frame.
+    static int gather(const OutboundQueue& queue, iovec* iov, int max) {
+        int count = 0;
+        size_t offset = queue.offset;
+        for (auto it = queue.frames.begin(); it != queue.frames.end() && count < max; ++it) {
+            iov[count].iov_base = const_cast<char*>((*it)->data()) + offset;
+            iov[count].iov_len = (*it)->size() - offset;
+            offset = 0;
+            ++count;
+        }
+        return count;
+    }
+
+    void mark_closing(Connection& conn) {
+        if (conn.closing) return;
+        conn.closing = true;
+        closing_fds.push_back(conn.fd);
+    }
+
+    void run_inbox() {
+        std::vector<Fanout> fanout_batch;
+        {
+            std::lock_guard<std::mutex> lock(inbox_mutex);
+            fanout_batch.swap(fanouts);
+        }
+        for (auto& fanout : fanout_batch) deliver(*fanout.message, fanout.ignore_id);
+    }
+
+    void expire_stalled() {
+        auto now = std::chrono::steady_clock::now();
+        for (auto& [fd, conn] : connections) {
+            if (conn->throttled && !conn->closing && now - conn->throttled_since > limits.stall_timeout) {
+                drop_slow_consumer(*conn);
+            }
+        }
+    }
+
+    void reap() {
+        while (!closing_fds.empty()) {
+            int fd = closing_fds.back();
+            closing_fds.pop_back();
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+
+            std::unique_ptr<Connection> conn = std::move(it->second);
+            connections.erase(it);
+            if (on_close) on_close(*this, *conn);
+
+            metrics.outbound_queued_bytes -= conn->outbound.bytes;
+            --metrics.connections;
+            if (conn->throttled) {
+                --throttled_count;
+                --metrics.slow_consumers;
+            }
+            release(std::move(conn));
+        }
+    }
+
+private:
+    void pump(Connection& conn) {
+        if (conn.pumping) return;  // a producer's own send() landed back here
+        conn.pumping = true;
+        while (!conn.closing && !conn.producers.empty() && conn.outbound.bytes < limits.low_watermark) {
+            if (!conn.producers.front()(*this, conn)) conn.producers.pop_front();
+        }
+        conn.pumping = false;
+    }
+
+    void notify() {
+        uint64_t one = 1;
+        write(wake_fd, &one, sizeof(one));
+    }
+
+    void deliver(const Broadcast& message, uint64_t ignore_id) {
+        for (auto& [fd, conn] : connections) {
+            if (conn->identified && !conn->closing && conn->id != ignore_id) send(*conn, message.frame(conn->encoding));
+        }
+    }
+
+    void drop_slow_consumer(Connection& conn) {
+        std::cerr << "[WARN] Dropping slow consumer '" << conn.username << "' with "
+                  << conn.outbound.bytes << " bytes queued." << std::endl;
+        ++metrics.slow_consumer_disconnects;
+        mark_closing(conn);
+    }
+};
+
+// Edge-triggered epoll backend.
+class EpollReactor : public Reactor {
+public:
+    explicit EpollReactor(int listen_fd) : Reactor(listen_fd) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+        // The listener is either this reactor's own SO_REUSEPORT socket or
+        // one shared by all of them, where EPOLLEXCLUSIVE stops a single
+        // connect from waking every reactor.
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = listen_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    }
+
+    ~EpollReactor() override { close(epoll_fd); }
+
+    void run() override {
+        this_reactor = this;
+        epoll_event events[64];
+        while (true) {
+            // Don't sleep while a socket still has unread input, and only wake
+            // up on a timer while someone is stalled.
+            int timeout = !backlog_fds.empty() ? 0 : throttled_count ? 1000 : -1;
+            int n = epoll_wait(epoll_fd, events, 64, timeout);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == wake_fd) {
+                    uint64_t count;
+                    read(wake_fd, &count, sizeof(count));
+                    run_inbox();
+                    continue;
+                }
+                if (fd == listen_fd) {
+                    accept_ready();
+                    continue;
+                }
+
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                Connection& conn = *it->second;
+
+                if ((events[i].events & EPOLLOUT) && !conn.closing) flush(conn);
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) read_ready(conn);
+            }
+            resume_backlog();
+            if (throttled_count) expire_stalled();
+            reap();
+        }
+    }
+
+private:
+    int epoll_fd;
+    std::vector<int> backlog_fds; // readable, but over budget or throttled last turn
+
+    void accept_ready() {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                return; // EAGAIN: drained, or another reactor took it
+            }
+
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                close(fd);
+                continue;
+            }
+            adopt(fd);
+        }
+    }
+
+    // Edge-triggered: keep reading until the kernel says EAGAIN, handing
+    // every complete frame on as soon as it is reassembled. A busy socket
+    // gets a bounded number of reads per turn so the inbox and other
+    // connections are not starved; resume_backlog() carries on.
+    void read_ready(Connection& conn) {
+        dispatch(conn);
+        for (int budget = 16; !conn.closing && !conn.throttled; --budget) {
+            if (budget == 0) {
+                backlog_fds.push_back(conn.fd);
+                return;
+            }
+            auto [space, len] = conn.inbound.write_space();
+            ssize_t bytes = recv(conn.fd, space, len, 0);
+            if (bytes > 0) {
+                conn.inbound.commit(bytes);
+                dispatch(conn);
+                continue;
+            }
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            mark_closing(conn);
+        }
+    }
+
+    // Gather as many queued frames as fit in one sendmsg() (writev with
+    // MSG_NOSIGNAL) until the queue is empty or the socket is full.
+    void flush(Connection& conn) override {
+        while (conn.outbound.bytes) {
+            iovec iov[64];
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = gather(conn.outbound, iov, 64);
+            ssize_t sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            if (sent > 0) {
+                wrote(conn, sent);
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            mark_closing(conn);
+            return;
+        }
+    }
+
+    // Input that no edge will announce again.
+    void on_drained(Connection& conn) override { backlog_fds.push_back(conn.fd); }
+
+    void resume_backlog() {
+        std::vector<int> pending;
+        pending.swap(backlog_fds);
+        for (int fd : pending) {
+            auto it = connections.find(fd);
+            if (it != connections.end() && !it->second->closing) read_ready(*it->second);
+        }
+    }
+
+    void release(std::unique_ptr<Connection> conn) override {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+    }
+};
+
+#endif // REACTOR_HPP
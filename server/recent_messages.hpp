@@ -0,0 +1,140 @@
+#ifndef RECENT_MESSAGES_HPP
+#define RECENT_MESSAGES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "message_store.hpp"
+#include "metrics.hpp"
+
+// The newest `capacity` messages of every channel, kept in memory so login
+// and OP 13 pages near the end of a channel never reach the MessageStore.
+// Rings are warmed from the store at startup and then fed by OP 0; a page that
+// reaches past the oldest cached message is a miss and goes to disk.
+class RecentMessages {
+public:
+    using Message = StoredMessage;
+
+    // 0 disables the cache: every page is a miss.
+    void set_capacity(size_t messages_per_channel) { capacity = messages_per_channel; }
+
+    // Fill the rings of `channel_ids` with their newest messages. Call
+    // before any worker starts.
+    void warm(MessageStore& store, const std::vector<int>& channel_ids) {
+        if (capacity == 0) return;
+        std::unique_lock<std::shared_mutex> lock(channels_mutex);
+        std::vector<Message> newest;
+        for (int channel_id : channel_ids) {
+            auto& ring = channels[channel_id];
+            ring = std::make_unique<Ring>();
+            newest.clear();
+            store.read_before(channel_id, INT64_MAX, capacity + 1, newest);
+            // One more than fits tells us whether anything older is stored.
+            ring->complete = newest.size() <= capacity;
+            if (!ring->complete) newest.pop_back();
+            ring->messages.assign(std::make_move_iterator(newest.rbegin()), std::make_move_iterator(newest.rend()));
+        }
+    }
+
+    // A channel that was just created has nothing stored yet.
+    void add_channel(int channel_id) {
+        if (capacity == 0) return;
+        std::unique_lock<std::shared_mutex> lock(channels_mutex);
+        auto& ring = channels[channel_id];
+        if (!ring) ring = std::make_unique<Ring>();
+    }
+
+    // Messages to channels without a ring are left to the database.
+    void add(int channel_id, Message message) {
+        Ring* ring = find(channel_id);
+        if (!ring) return;
+
+        std::lock_guard<std::mutex> lock(ring->mutex);
+        auto& messages = ring->messages;
+        // Workers submit concurrently, so ids can land slightly out of order.
+        auto at = messages.end();
+        while (at != messages.begin() && std::prev(at)->id > message.id) --at;
+        messages.insert(at, std::move(message));
+        if (messages.size() > capacity) {
+            messages.pop_front();
+            ring->complete = false;
+        }
+    }
+
+    // Forget a message that was cached but never stored.
+    void remove(int channel_id, int64_t id) {
+        Ring* ring = find(channel_id);
+        if (!ring) return;
+        std::lock_guard<std::mutex> lock(ring->mutex);
+        auto& messages = ring->messages;
+        auto it = std::lower_bound(messages.begin(), messages.end(), id, [](const Message& m, int64_t wanted) { return m.id < wanted; });
+        if (it != messages.end() && it->id == id) messages.erase(it);
+    }
+
+    // The same page history_page() would read from disk: up to `limit`
+    // messages, oldest first, before `before` (0 = newest) or after
+    // `after` when it is set. False on a miss, leaving `out` empty.
+    bool page(int channel_id, int64_t before, int64_t after, int limit, std::vector<Message>& out, bool& has_more) {
+        Ring* ring = find(channel_id);
+        if (ring && read(*ring, before, after, static_cast<size_t>(limit), out, has_more)) {
+            ++metrics.history_cache_hits;
+            return true;
+        }
+        ++metrics.history_cache_misses;
+        return false;
+    }
+
+private:
+    struct Ring {
+        std::mutex mutex;
+        std::deque<Message> messages;  // ascending by id
+        bool complete = true;          // nothing older than messages.front() stored
+    };
+
+    size_t capacity = 0;
+    std::shared_mutex channels_mutex;
+    std::unordered_map<int, std::unique_ptr<Ring>> channels;
+
+    Ring* find(int channel_id) {
+        std::shared_lock<std::shared_mutex> lock(channels_mutex);
+        auto it = channels.find(channel_id);
+        return it != channels.end() ? it->second.get() : nullptr;
+    }
+
+    static bool read(Ring& ring, int64_t before, int64_t after, size_t limit, std::vector<Message>& out, bool& has_more) {
+        std::lock_guard<std::mutex> lock(ring.mutex);
+        auto& messages = ring.messages;
+
+        if (after > 0) {
+            // Only a hit if nothing between `after` and the ring is on disk.
+            if (!ring.complete && (messages.empty() || after < messages.front().id)) return false;
+            auto first = std::upper_bound(messages.begin(), messages.end(), after, [](int64_t id, const Message& m) { return id < m.id; });
+            size_t available = static_cast<size_t>(messages.end() - first);
+            has_more = available > limit;
+            out.assign(first, first + std::min(available, limit));
+            return true;
+        }
+
+        auto end = before > 0
+            ? std::lower_bound(messages.begin(), messages.end(), before, [](const Message& m, int64_t id) { return m.id < id; })
+            : messages.end();
+        size_t available = static_cast<size_t>(end - messages.begin());
+        // Short of a full page, the rest is on disk. An incomplete ring
+        // always has something older there.
+        if (available < limit && !ring.complete) return false;
+        has_more = available > limit || !ring.complete;
+        out.assign(end - std::min(available, limit), end);
+        return true;
+    }
+};
+
+inline RecentMessages recent_messages;
+
+#endif // RECENT_MESSAGES_HPP
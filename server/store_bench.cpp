@@ -0,0 +1,77 @@
+// Compares MessageStore backends on the same synthetic traffic: batched
+// appends spread over a number of channels, then random OP 13-sized pages
+// read back. Runs in its own directory so it never touches a live database.
+//
+//     g++ -std=c++17 -O2 server/store_bench.cpp -o store_bench -lsqlite3 -lz -pthread
+//     ./store_bench [sqlite|log] [messages] [channels] [batch] [content bytes]
+
+#include <unistd.h>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "message_log.hpp"
+#include "message_store.hpp"
+#include "migrations.hpp"
+
+int main(int argc, char* argv[]) {
+    std::string backend = argc > 1 ? argv[1] : "sqlite";
+    size_t messages = argc > 2 ? std::stoul(argv[2]) : 200000;
+    int channels = argc > 3 ? std::stoi(argv[3]) : 16;
+    size_t batch_size = argc > 4 ? std::stoul(argv[4]) : 256;
+    size_t content_bytes = argc > 5 ? std::stoul(argv[5]) : 100;
+    if (backend != "sqlite" && backend != "log") {
+        std::cerr << "usage: store_bench [sqlite|log] [messages] [channels] [batch] [content bytes]" << std::endl;
+        return 1;
+    }
+
+    std::string directory = "store_bench." + backend;
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    if (chdir(directory.c_str()) != 0) return 1;
+
+    std::unique_ptr<MessageStore> store;
+    if (backend == "log") {
+        store = std::make_unique<LogMessageStore>("message_log", 64 << 20);
+    } else {
+        local_db().exec("PRAGMA journal_mode = WAL;");
+        if (!migrate(local_db())) return 1;
+        read_pool.open(database_path, 1);
+        store = std::make_unique<SqliteMessageStore>();
+    }
+
+    std::mt19937 random(42);
+    std::string content(content_bytes, 'x');
+    std::vector<ChannelMessage> batch;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t id = 1; id <= messages; ++id) {
+        batch.push_back({static_cast<int>(random() % channels) + 1, {static_cast<int64_t>(id), "bench", content}});
+        if (batch.size() == batch_size || id == messages) {
+            if (!store->append(batch)) {
+                std::cerr << "append failed" << std::endl;
+                return 1;
+            }
+            batch.clear();
+        }
+    }
+    double write_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const size_t pages = 20000;
+    std::vector<StoredMessage> page;
+    size_t read = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pages; ++i) {
+        page.clear();
+        store->read_before(static_cast<int>(random() % channels) + 1, static_cast<int64_t>(random() % messages) + 1, 50, page);
+        read += page.size();
+    }
+    double read_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << backend << ": " << messages << " messages in " << write_seconds << " s (" << static_cast<size_t>(messages / write_seconds)
+              << "/s), " << pages << " pages (" << read << " messages) in " << read_seconds << " s (" << static_cast<size_t>(pages / read_seconds)
+              << " pages/s)" << std::endl;
+    return 0;
+}
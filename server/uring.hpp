@@ -0,0 +1,203 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+// Just enough io_uring for the gateway, on the raw syscalls so the server
+// does not need liburing. A ring belongs to the thread that created it.
+class Uring {
+public:
+    Uring() = default;
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    ~Uring() {
+        if (ring_fd < 0) return;
+        munmap(sqes, sqes_size);
+        if (cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        munmap(sq_ptr, sq_size);
+        close(ring_fd);
+    }
+
+    // Returns 0 or -errno. Tries `flags` first and falls back to a plain ring
+    // on kernels that reject them.
+    int init(unsigned entries, unsigned flags = 0) {
+        io_uring_params p{};
+        p.flags = flags;
+        ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (ring_fd < 0 && flags) {
+            p = io_uring_params{};
+            ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+        }
+        if (ring_fd < 0) return -errno;
+
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) return fail();
+        cq_ptr = sq_ptr;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+            cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) return fail();
+        }
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return fail();
+
+        char* sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_entries = p.sq_entries;
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        pending_tail = *sq_tail;
+
+        char* cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return 0;
+    }
+
+    // A zeroed SQE. Submits what is already queued if the ring is full.
+    io_uring_sqe* get_sqe() {
+        while (pending_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) submit(0);
+        unsigned index = pending_tail & sq_mask;
+        sq_array[index] = index;
+        ++pending_tail;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Publish queued SQEs and, with wait_nr > 0, block until that many
+    // completions are ready. Returns io_uring_enter's result.
+    int submit(unsigned wait_nr) {
+        unsigned to_submit = pending_tail - *sq_tail;
+        __atomic_store_n(sq_tail, pending_tail, __ATOMIC_RELEASE);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    // Calls fn(cqe) for every completion that is ready and retires them.
+    template <typename F>
+    unsigned drain(F&& fn) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; ++head, ++count) {
+            io_uring_cqe cqe = cqes[head & cq_mask];
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            fn(cqe);
+        }
+        return count;
+    }
+
+    int register_op(unsigned opcode, const void* arg, unsigned nr_args) {
+        int ret = syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+        return ret < 0 ? -errno : ret;
+    }
+
+private:
+    int ring_fd = -1;
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0, sq_entries = 0;
+    unsigned pending_tail = 0; // SQEs handed out but not yet published
+    io_uring_sqe* sqes = nullptr;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    int fail() {
+        int err = -errno;
+        close(ring_fd);
+        ring_fd = -1;
+        return err;
+    }
+};
+
+// A provided-buffer ring (IORING_REGISTER_PBUF_RING): fixed buffers that
+// the kernel picks from for multishot receives, handed back with recycle().
+class BufferRing {
+public:
+    BufferRing() = default;
+    BufferRing(const BufferRing&) = delete;
+    BufferRing& operator=(const BufferRing&) = delete;
+
+    ~BufferRing() {
+        if (ring) munmap(ring, ring_size);
+        delete[] storage;
+    }
+
+    // `count` must be a power of two.
+    bool init(Uring& uring, uint16_t group, unsigned count, unsigned size) {
+        buffer_size = size;
+        mask = count - 1;
+        ring_size = count * sizeof(io_uring_buf);
+        void* mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return false;
+        ring = static_cast<io_uring_buf_ring*>(mem);
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (uring.register_op(IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+        storage = new char[size_t(count) * size];
+        for (unsigned bid = 0; bid < count; ++bid) add(bid);
+        publish();
+        return true;
+    }
+
+    char* buffer(uint16_t bid) { return storage + size_t(bid) * buffer_size; }
+
+    void recycle(uint16_t bid) {
+        add(bid);
+        publish();
+    }
+
+private:
+    io_uring_buf_ring* ring = nullptr;
+    size_t ring_size = 0;
+    char* storage = nullptr;
+    unsigned buffer_size = 0;
+    unsigned mask = 0;
+    uint16_t tail = 0;
+
+    void add(uint16_t bid) {
+        // Not ring->bufs: in C++ the UAPI flex-array wrapper shifts it by
+        // eight bytes. The ring is simply an array of io_uring_buf.
+        io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(ring) + (tail & mask);
+        buf->addr = reinterpret_cast<uint64_t>(buffer(bid));
+        buf->len = buffer_size;
+        buf->bid = bid;
+        ++tail;
+    }
+
+    void publish() { __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE); }
+};
+
+#endif // URING_HPP
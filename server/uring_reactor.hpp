@@ -0,0 +1,346 @@
+#ifndef URING_REACTOR_HPP
+#define URING_REACTOR_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/time_types.h>
+#include "reactor.hpp"
+#include "uring.hpp"
+
+struct UringConnection : Connection {
+    iovec iov[64];
+    msghdr msg{};
+    bool recv_armed = false;
+    bool send_inflight = false;
+    int inflight = 0; // SQEs whose final CQE has not been seen yet
+};
+
+// io_uring backend: one multishot accept on the listener, one multishot
+// recv per connection drawing from a provided-buffer ring, and at most one
+// sendmsg in flight per connection. Everything is submitted in a single
+// io_uring_enter per loop turn.
+class UringReactor : public Reactor {
+public:
+    explicit UringReactor(int listen_fd) : Reactor(listen_fd) {
+        // io_uring reports EAGAIN instead of waiting on O_NONBLOCK files.
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) & ~O_NONBLOCK);
+    }
+
+    // True when this kernel has everything run() relies on (provided
+    // buffer rings and multishot recv, i.e. 6.0+). Probed once on a
+    // socketpair so the caller can fall back to epoll.
+    static bool supported() {
+        Uring uring;
+        if (uring.init(8) < 0) return false;
+        BufferRing probe_buffers;
+        if (!probe_buffers.init(uring, 0, 1, 64)) return false;
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return false;
+        io_uring_sqe* sqe = uring.get_sqe();
+        prep_recv_multishot(sqe, sv[0], 0);
+        write(sv[1], "x", 1);
+        int res = -EINVAL;
+        if (uring.submit(1) >= 0) uring.drain([&](const io_uring_cqe& cqe) { res = cqe.res; });
+        close(sv[0]);
+        close(sv[1]);
+        return res == 1;
+    }
+
+    void run() override {
+        this_reactor = this;
+        // The ring has to be created on the thread that drives it.
+        if (ring.init(4096, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN) < 0 ||
+            !buffers.init(ring, BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE) ||
+            file_ring.init(FILE_BATCH * 2) < 0) {
+            std::cerr << "[ERR] io_uring setup failed on reactor thread" << std::endl;
+            return;
+        }
+
+        arm_accept();
+        arm_wake();
+        arm_tick();
+        while (true) {
+            ring.submit(1);
+            ring.drain([this](const io_uring_cqe& cqe) { complete(cqe); });
+            reap();
+        }
+    }
+
+    // Upload and download bodies go through the ring as well: the file is
+    // split into chunks that are all submitted with one io_uring_enter.
+    bool read_file(const std::string& path, std::string& out) override {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok) {
+            out.resize(st.st_size);
+            size_t done = file_io(fd, IORING_OP_READ, out.data(), out.size());
+            out.resize(done); // shorter if the file shrank underneath us
+        }
+        close(fd);
+        return ok;
+    }
+
+    bool write_file(const std::string& path, const std::string& data) override {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        size_t done = file_io(fd, IORING_OP_WRITE, const_cast<char*>(data.data()), data.size());
+        close(fd);
+        return done == data.size();
+    }
+
+private:
+    enum Op : uint64_t { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_WAKE, OP_TICK, OP_CANCEL };
+
+    static constexpr uint16_t BUFFER_GROUP = 0;
+    static constexpr unsigned BUFFER_COUNT = 256;
+    static constexpr unsigned BUFFER_SIZE = 16 * 1024;
+    static constexpr unsigned FILE_BATCH = 8;
+    static constexpr size_t FILE_CHUNK = 1024 * 1024;
+
+    Uring ring;
+    Uring file_ring;
+    BufferRing buffers;
+    uint64_t wake_value = 0;
+    __kernel_timespec tick{1, 0};
+    // Closed connections whose SQEs are still in flight. Their fds stay open
+    // until the last CQE arrives so the number cannot be reused under us.
+    std::unordered_map<int, std::unique_ptr<Connection>> draining;
+
+    static uint64_t tag(Op op, int fd) { return (uint64_t(op) << 32) | uint32_t(fd); }
+
+    static void prep_recv_multishot(io_uring_sqe* sqe, int fd, uint64_t user_data) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->user_data = user_data;
+    }
+
+    std::unique_ptr<Connection> create_connection() override { return std::make_unique<UringConnection>(); }
+
+    void arm_accept() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = tag(OP_ACCEPT, listen_fd);
+    }
+
+    void arm_wake() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = wake_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&wake_value);
+        sqe->len = sizeof(wake_value);
+        sqe->user_data = tag(OP_WAKE, wake_fd);
+    }
+
+    void arm_tick() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = reinterpret_cast<uint64_t>(&tick);
+        sqe->len = 1;
+        sqe->user_data = tag(OP_TICK, 0);
+    }
+
+    void arm_recv(UringConnection& conn) {
+        prep_recv_multishot(ring.get_sqe(), conn.fd, tag(OP_RECV, conn.fd));
+        conn.recv_armed = true;
+        ++conn.inflight;
+    }
+
+    void flush(Connection& base) override {
+        auto& conn = static_cast<UringConnection&>(base);
+        if (conn.send_inflight || conn.closing || !conn.outbound.bytes) return;
+        conn.msg = msghdr{};
+        conn.msg.msg_iov = conn.iov;
+        conn.msg.msg_iovlen = gather(conn.outbound, conn.iov, 64);
+
+        io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = tag(OP_SEND, conn.fd);
+        conn.send_inflight = true;
+        ++conn.inflight;
+    }
+
+    // Stop the multishot recv; whatever it already delivered stays buffered.
+    void on_throttled(Connection& base) override {
+        auto& conn = static_cast<UringConnection&>(base);
+        if (!conn.recv_armed) return;
+        io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = tag(OP_RECV, conn.fd);
+        sqe->user_data = tag(OP_CANCEL, conn.fd);
+    }
+
+    void on_drained(Connection& base) override {
+        auto& conn = static_cast<UringConnection&>(base);
+        dispatch(conn);
+        if (!conn.recv_armed && !conn.closing) arm_recv(conn);
+    }
+
+    // shutdown() makes the outstanding recv and send complete; the fd is
+    // closed once they have.
+    void release(std::unique_ptr<Connection> base) override {
+        auto& conn = static_cast<UringConnection&>(*base);
+        if (conn.inflight == 0) {
+            close(conn.fd);
+            return;
+        }
+        shutdown(conn.fd, SHUT_RDWR);
+        draining.emplace(conn.fd, std::move(base));
+    }
+
+    UringConnection* find(int fd, bool& live) {
+        auto it = connections.find(fd);
+        live = it != connections.end();
+        if (live) return static_cast<UringConnection*>(it->second.get());
+        auto zombie = draining.find(fd);
+        return zombie == draining.end() ? nullptr : static_cast<UringConnection*>(zombie->second.get());
+    }
+
+    void settle(UringConnection& conn, bool live) {
+        if (live || conn.inflight) return;
+        close(conn.fd);
+        draining.erase(conn.fd);
+    }
+
+    void complete(const io_uring_cqe& cqe) {
+        Op op = static_cast<Op>(cqe.user_data >> 32);
+        int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+
+        switch (op) {
+        case OP_ACCEPT:
+            if (cqe.res >= 0) arm_recv(static_cast<UringConnection&>(adopt(cqe.res)));
+            if (!more) arm_accept();
+            break;
+
+        case OP_RECV: {
+            bool live;
+            UringConnection* conn = find(fd, live);
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                if (live && cqe.res > 0) append(*conn, buffers.buffer(bid), cqe.res);
+                buffers.recycle(bid);
+            }
+            if (!conn) break;
+            if (!more) {
+                conn->recv_armed = false;
+                --conn->inflight;
+            }
+            if (!live) {
+                settle(*conn, live);
+                break;
+            }
+
+            if (cqe.res > 0) {
+                dispatch(*conn);
+                if (!more && !conn->throttled && !conn->closing) arm_recv(*conn);
+            } else if (cqe.res == -ENOBUFS) {
+                // Every provided buffer was in use; the recv ended, start another.
+                if (!conn->throttled && !conn->closing) arm_recv(*conn);
+            } else if (cqe.res == -ECANCELED) {
+                // Cancelled by on_throttled(), but the queue may have drained
+                // before the cancel landed, while on_drained() still saw the
+                // recv armed and left it alone.
+                if (!conn->throttled && !conn->closing) arm_recv(*conn);
+            } else {
+                mark_closing(*conn); // 0 is EOF
+            }
+            break;
+        }
+
+        case OP_SEND: {
+            bool live;
+            UringConnection* conn = find(fd, live);
+            if (!conn) break;
+            conn->send_inflight = false;
+            --conn->inflight;
+            if (!live) {
+                settle(*conn, live);
+                break;
+            }
+            if (cqe.res > 0) {
+                wrote(*conn, cqe.res);
+                flush(*conn);
+            } else {
+                mark_closing(*conn);
+            }
+            break;
+        }
+
+        case OP_WAKE:
+            run_inbox();
+            arm_wake();
+            break;
+
+        case OP_TICK:
+            if (throttled_count) expire_stalled();
+            arm_tick();
+            break;
+
+        case OP_CANCEL:
+            break;
+        }
+    }
+
+    void append(Connection& conn, const char* data, size_t len) {
+        while (len) {
+            auto [space, room] = conn.inbound.write_space(std::min<size_t>(len, 4096));
+            size_t n = std::min(room, len);
+            memcpy(space, data, n);
+            conn.inbound.commit(n);
+            data += n;
+            len -= n;
+        }
+    }
+
+    // Runs `opcode` over [buf, buf + len) at matching file offsets, FILE_BATCH
+    // chunks per io_uring_enter. Returns how many leading bytes completed.
+    size_t file_io(int fd, uint8_t opcode, char* buf, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            unsigned queued = 0;
+            for (size_t off = done; queued < FILE_BATCH && off < len; ++queued, off += FILE_CHUNK) {
+                io_uring_sqe* sqe = file_ring.get_sqe();
+                sqe->opcode = opcode;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(buf + off);
+                sqe->len = std::min(FILE_CHUNK, len - off);
+                sqe->off = off;
+                sqe->user_data = off;
+            }
+
+            // A short or failed chunk ends the transfer at the last byte it
+            // managed.
+            size_t reached = len;
+            unsigned reaped = 0;
+            file_ring.submit(queued);
+            while (reaped < queued) {
+                reaped += file_ring.drain([&](const io_uring_cqe& cqe) {
+                    size_t off = cqe.user_data;
+                    size_t want = std::min(FILE_CHUNK, len - off);
+                    if (cqe.res < 0 || size_t(cqe.res) < want) reached = std::min(reached, off + std::max(cqe.res, 0));
+                });
+                if (reaped < queued) file_ring.submit(1);
+            }
+
+            size_t batch_end = std::min(len, done + size_t(queued) * FILE_CHUNK);
+            if (reached < batch_end) return reached;
+            done = batch_end;
+        }
+        return done;
+    }
+};
+
+#endif // URING_REACTOR_HPP
@@ -0,0 +1,111 @@
+// Loopback load for the voice relay: `rooms` rooms of `listeners` members
+// each, plus one speaker per room, all sending as fast as they can. Reports
+// forwarded datagrams per second and the relay threads' CPU time per
+// forwarded datagram, so relay changes can be compared on the same machine.
+//
+//     g++ -std=c++17 -O2 server/voice_bench.cpp -o voice_bench -pthread
+//     ./voice_bench [rooms] [listeners] [seconds] [batch] [workers] [gso] [path_mtu] [payload]
+//
+// Run once with gso 0 and once with 1 to see what UDP_SEGMENT saves.
+// Loopback's own MTU is 64 KiB, so the relay is held to `path_mtu`
+// (default 1500, Ethernet) as it would be in front of real listeners, and
+// speakers send the client's datagram size by default.
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "voice_relay.hpp"
+
+namespace {
+
+int udp_socket(sockaddr_in& bound, bool reuseport = false) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int opt = 1;
+    if (reuseport) setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    bound.sin_family = AF_INET;
+    bound.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (sockaddr*)&bound, sizeof(bound));
+    socklen_t length = sizeof(bound);
+    getsockname(fd, (sockaddr*)&bound, &length);
+    int buffer = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    return fd;
+}
+
+double thread_cpu_seconds(pthread_t thread) {
+    clockid_t clock;
+    timespec now{};
+    if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &now) != 0) return 0;
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int rooms = argc > 1 ? std::stoi(argv[1]) : 4;
+    int listeners = argc > 2 ? std::stoi(argv[2]) : 50;
+    int seconds = argc > 3 ? std::stoi(argv[3]) : 5;
+    unsigned batch = argc > 4 ? std::stoul(argv[4]) : 32;
+    // Each worker is an RCU reader of the relay table, same cap as voice_relay().
+    unsigned count = std::clamp<unsigned>(argc > 5 ? std::stoul(argv[5]) : 1, 1, RcuPointer<RelayTable>::max_readers);
+    bool gso = argc > 6 && std::stoi(argv[6]) != 0;
+    size_t path_mtu = argc > 7 ? std::stoul(argv[7]) : 1500;
+    size_t payload = argc > 8 ? std::stoul(argv[8]) : voice_max_payload;
+
+    // The relay workers, as voice_relay() starts them but on loopback and
+    // with their threads kept for the CPU clocks.
+    sockaddr_in relay_addr{};
+    std::vector<std::unique_ptr<VoiceRelay>> workers;
+    std::vector<pthread_t> threads;
+    for (unsigned i = 0; i < count; ++i) {
+        int fd = udp_socket(relay_addr, count > 1);
+        workers.push_back(std::make_unique<VoiceRelay>(fd, batch, gso, path_mtu));
+    }
+    for (auto& worker : workers) {
+        std::thread thread(&VoiceRelay::run, worker.get());
+        threads.push_back(thread.native_handle());
+        thread.detach();
+    }
+
+    // Each room: listeners first, then its speaker.
+    std::vector<int> speakers;
+    uint64_t connection_id = 0;
+    for (int room = 1; room <= rooms; ++room) {
+        for (int i = 0; i <= listeners; ++i) {
+            sockaddr_in member{};
+            int fd = udp_socket(member);
+            int previous;
+            voice_rooms.bind(voice_rooms.join(++connection_id, room, previous), member);
+            if (i == listeners) speakers.push_back(fd);
+        }
+    }
+
+    // Whatever the relay can't keep up with the kernel drops, so only
+    // forwarded datagrams are counted.
+    std::vector<char> audio(std::min(payload, VoiceRelay::max_packet), 1);
+    auto cpu = [&] {
+        double total = 0;
+        for (pthread_t thread : threads) total += thread_cpu_seconds(thread);
+        return total;
+    };
+    auto start = std::chrono::steady_clock::now();
+    double cpu_start = cpu();
+    uint64_t out_start = metrics.voice_packets_out.load();
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds)) {
+        for (int speaker : speakers) sendto(speaker, audio.data(), audio.size(), 0, (sockaddr*)&relay_addr, sizeof(relay_addr));
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double relay_cpu = cpu() - cpu_start;
+    uint64_t forwarded = metrics.voice_packets_out.load() - out_start;
+
+    std::cout << "rooms=" << rooms << " listeners=" << listeners << " batch=" << batch << " workers=" << count << " gso=" << gso << " path_mtu=" << path_mtu << " payload=" << audio.size() << ": "
+              << static_cast<uint64_t>(forwarded / elapsed) << " datagrams/s out, relay CPU " << (forwarded ? relay_cpu * 1e9 / forwarded : 0)
+              << " ns/datagram" << std::endl;
+    return 0;
+}
@@ -0,0 +1,484 @@
+#ifndef VOICE_RELAY_HPP
+#define VOICE_RELAY_HPP
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../include/voice.hpp"
+#include "metrics.hpp"
+
+// Publishes immutable versions of a T to reader threads that never lock.
+// A reader brackets each use with enter()/exit() on its own slot; the
+// writer swaps in a new version and frees an old one only once every
+// reader has either left or entered after the swap. Writers must be
+// serialized by the caller.
+template <typename T>
+class RcuPointer {
+public:
+    static constexpr size_t max_readers = 64;
+
+    RcuPointer() {
+        for (auto& slot : readers) slot.store(idle);
+    }
+
+    ~RcuPointer() {
+        delete current.load();
+        for (auto& [generation, old] : retired) delete old;
+    }
+
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    size_t add_reader() { return reader_count.fetch_add(1); }
+
+    // The current version, valid until exit(). Null before the first publish().
+    const T* enter(size_t reader) {
+        readers[reader].store(generation.load());
+        return current.load();
+    }
+
+    void exit(size_t reader) { readers[reader].store(idle, std::memory_order_release); }
+
+    void publish(std::unique_ptr<const T> next) {
+        const T* old = current.exchange(next.release());
+        uint64_t published = generation.fetch_add(1) + 1;
+        if (old) retired.push_back({published, old});
+
+        // A version retired at generation g is unreachable once no reader
+        // announced a generation below g.
+        uint64_t oldest = idle;
+        for (size_t i = 0; i < reader_count.load(); ++i) oldest = std::min(oldest, readers[i].load());
+        auto reachable = std::partition(retired.begin(), retired.end(), [&](auto& entry) { return entry.first > oldest; });
+        for (auto it = reachable; it != retired.end(); ++it) delete it->second;
+        retired.erase(reachable, retired.end());
+    }
+
+private:
+    static constexpr uint64_t idle = UINT64_MAX;
+
+    std::atomic<const T*> current{nullptr};
+    std::atomic<uint64_t> generation{0};
+    std::atomic<size_t> reader_count{0};
+    std::array<std::atomic<uint64_t>, max_readers> readers;
+    std::vector<std::pair<uint64_t, const T*>> retired;  // writer only
+};
+
+// What the relay forwards by: every bound endpoint, grouped by room, plus
+// an open-addressing table from a raw (address, port) to its room. Built
+// on each membership change and never modified afterwards.
+struct RelayTable {
+    struct Slot {
+        uint64_t key = 0;  // 0 = empty; a real endpoint always has a port
+        uint32_t room = 0;
+    };
+
+    struct Room {
+        uint32_t begin, end;  // range of `endpoints`
+    };
+
+    std::vector<Slot> slots;  // power-of-two size, at most half full
+    std::vector<Room> rooms;
+    std::vector<sockaddr_in> endpoints;
+
+    static uint64_t key(const sockaddr_in& endpoint) {
+        return uint64_t(endpoint.sin_addr.s_addr) << 16 | endpoint.sin_port;
+    }
+
+    // The room of `endpoint`, or null if it is not bound.
+    const Room* find(const sockaddr_in& endpoint) const {
+        uint64_t wanted = key(endpoint);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(wanted) & mask;; i = (i + 1) & mask) {
+            if (slots[i].key == wanted) return &rooms[slots[i].room];
+            if (slots[i].key == 0) return nullptr;
+        }
+    }
+
+    void insert(const sockaddr_in& endpoint, uint32_t room) {
+        uint64_t k = key(endpoint);
+        size_t mask = slots.size() - 1;
+        size_t i = hash(k) & mask;
+        while (slots[i].key != 0 && slots[i].key != k) i = (i + 1) & mask;
+        slots[i] = {k, room};
+    }
+
+    static size_t hash(uint64_t key) { return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32); }
+};
+
+// Who is in which voice channel, and from which UDP endpoint. Members
+// join and leave through OP 6 on the gateway; the relay binds their
+// endpoint when their hello arrives and routes audio by it.
+class VoiceRooms {
+public:
+    // Puts `connection_id` in `channel_id`'s room and returns the token its
+    // hello must carry. Any room it was already in is left; `previous` is
+    // that channel, 0 if there was none.
+    uint64_t join(uint64_t connection_id, int channel_id, int& previous) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if ((previous = remove(connection_id))) publish();
+        uint64_t token;
+        do token = random_token(); while (token == 0 || by_token.count(token));
+        members[connection_id] = {token, channel_id, false, {}};
+        by_token[token] = connection_id;
+        rooms[channel_id].push_back(connection_id);
+        return token;
+    }
+
+    // The channel `connection_id` left, 0 if it was not in one.
+    int leave(uint64_t connection_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int channel_id = remove(connection_id);
+        if (channel_id) publish();
+        return channel_id;
+    }
+
+    // A hello: route `endpoint` as the member holding `token`. A member
+    // whose address changes (NAT rebinding) just sends a new hello.
+    bool bind(uint64_t token, const sockaddr_in& endpoint) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto holder = by_token.find(token);
+        if (holder == by_token.end()) return false;
+        Member& member = members[holder->second];
+        // The periodic hello from an endpoint already bound changes nothing:
+        // don't rebuild the table for it.
+        if (member.bound && RelayTable::key(member.endpoint) == RelayTable::key(endpoint)) return true;
+        if (member.bound) by_endpoint.erase(RelayTable::key(member.endpoint));
+        by_endpoint.erase(RelayTable::key(endpoint));
+        member.bound = true;
+        member.endpoint = endpoint;
+        by_endpoint[RelayTable::key(endpoint)] = holder->second;
+        publish();
+        return true;
+    }
+
+    // Forwarding state for relay threads: the table as of the last change.
+    RcuPointer<RelayTable> table;
+
+private:
+    struct Member {
+        uint64_t token;
+        int channel_id;
+        bool bound;
+        sockaddr_in endpoint;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Member> members;           // by gateway connection id
+    std::unordered_map<uint64_t, uint64_t> by_token;       // token -> connection id
+    std::unordered_map<uint64_t, uint64_t> by_endpoint;    // RelayTable::key(endpoint) -> connection id
+    std::unordered_map<int, std::vector<uint64_t>> rooms;  // channel -> connection ids
+    std::mt19937_64 random_token{std::random_device{}()};
+
+    // Rebuild the relay table from the members. Called with `mutex` held.
+    void publish() {
+        auto next = std::make_unique<RelayTable>();
+        size_t slots = 16;
+        while (slots < 2 * by_endpoint.size()) slots *= 2;
+        next->slots.resize(slots);
+        for (auto& [channel_id, room] : rooms) {
+            uint32_t index = static_cast<uint32_t>(next->rooms.size());
+            uint32_t begin = static_cast<uint32_t>(next->endpoints.size());
+            for (uint64_t connection_id : room) {
+                const Member& member = members[connection_id];
+                if (!member.bound) continue;
+                next->endpoints.push_back(member.endpoint);
+                next->insert(member.endpoint, index);
+            }
+            next->rooms.push_back({begin, static_cast<uint32_t>(next->endpoints.size())});
+        }
+        table.publish(std::move(next));
+    }
+
+    int remove(uint64_t connection_id) {
+        auto it = members.find(connection_id);
+        if (it == members.end()) return 0;
+        const Member& member = it->second;
+        by_token.erase(member.token);
+        if (member.bound) by_endpoint.erase(RelayTable::key(member.endpoint));
+        auto& room = rooms[member.channel_id];
+        room.erase(std::remove(room.begin(), room.end(), connection_id), room.end());
+        if (room.empty()) rooms.erase(member.channel_id);
+        int channel_id = member.channel_id;
+        members.erase(it);
+        return channel_id;
+    }
+};
+
+inline VoiceRooms voice_rooms;
+
+inline int open_voice_socket(int port, bool reuseport) {
+    int udp_sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int opt = 1;
+    if (reuseport) setsockopt(udp_sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(udp_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        std::cerr << "[VOICE] UDP Bind failed!" << std::endl;
+        close(udp_sock);
+        return -1;
+    }
+    return udp_sock;
+}
+
+// One relay worker on one UDP socket. Hellos bind endpoints, and audio
+// from a bound endpoint is forwarded to the rest of its room only. Each
+// wakeup takes up to `batch` datagrams with one recvmmsg, and the whole
+// fan-out of that batch goes out through sendmmsg, so the syscall count
+// no longer scales with packets times listeners. Every buffer is
+// allocated up front.
+//
+// With several workers the sockets share the port through SO_REUSEPORT,
+// and the kernel picks a worker per sender, by its address. The worker a
+// datagram lands on fans it out itself, from its own socket: the sockets
+// share the port, so listeners can't tell them apart, and every worker
+// reads the same relay table. No datagram crosses threads, and each
+// sender's audio stays in order on one worker.
+//
+// With `gso`, datagrams of one flush that go to the same listener (from
+// several speakers, or a burst from one) leave as a single UDP_SEGMENT
+// send that the kernel splits late, so the route lookup and most of the
+// per-datagram stack work happen once per listener. Segments must be
+// equal-sized and fit the path MTU unfragmented, so only datagrams whose
+// IP packet fits `path_mtu` are coalesced; larger ones go out plain. The
+// kernel can't check that for us ahead of time: an unconnected socket has
+// no route. Where the kernel refuses anyway, the relay sends those
+// datagrams one by one and stays on sendmmsg.
+class VoiceRelay {
+public:
+    static constexpr size_t max_packet = 4096;
+    static constexpr size_t max_sends = 1024;  // per sendmmsg
+    static constexpr size_t max_segments = 64;       // per UDP_SEGMENT send, the oldest kernels' limit
+    static constexpr size_t max_segment_bytes = 65507;  // one UDP payload
+    static constexpr size_t ip_udp_headers = 28;        // IPv4 + UDP
+
+    VoiceRelay(int fd, unsigned batch, bool gso, size_t path_mtu)
+        : fd(fd), batch(std::clamp(batch, 1u, 1024u)), gso(gso), path_mtu(path_mtu), buffers(this->batch * max_packet),
+          senders(this->batch), receive_iov(this->batch), receive(this->batch), send_iov(max_sends), sends(max_sends),
+          by_destination(max_sends), segment_iov(max_sends), segmented(max_sends), segment_counts(max_sends), controls(max_sends) {
+        int segment_size = 0;
+        socklen_t length = sizeof(segment_size);
+        if (this->gso && getsockopt(fd, IPPROTO_UDP, UDP_SEGMENT, &segment_size, &length) < 0) {
+            std::cerr << "[VOICE] No UDP GSO on this kernel, using sendmmsg" << std::endl;
+            this->gso = false;
+        }
+        for (size_t i = 0; i < this->batch; ++i) {
+            receive_iov[i] = {&buffers[i * max_packet], max_packet};
+            receive[i].msg_hdr.msg_iov = &receive_iov[i];
+            receive[i].msg_hdr.msg_iovlen = 1;
+        }
+        for (size_t i = 0; i < max_sends; ++i) {
+            sends[i].msg_hdr.msg_iov = &send_iov[i];
+            sends[i].msg_hdr.msg_iovlen = 1;
+            sends[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        }
+    }
+
+    void run() {
+        size_t reader = voice_rooms.table.add_reader();
+        while (true) {
+            for (size_t i = 0; i < batch; ++i) {
+                receive[i].msg_hdr.msg_name = &senders[i];
+                receive[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            }
+            // Block for the first datagram, then take whatever else is queued.
+            int received = recvmmsg(fd, receive.data(), batch, MSG_WAITFORONE, nullptr);
+            if (received <= 0) continue;
+
+            // The hot path: no lock and no allocation, just a probe of the
+            // current table per datagram. The table stays pinned until the
+            // batch's sends, which point into it, are done.
+            const RelayTable* table = voice_rooms.table.enter(reader);
+            uint64_t forwarded = 0, dropped = 0;
+            for (int i = 0; i < received; ++i) {
+                const char* data = &buffers[i * max_packet];
+                size_t size = receive[i].msg_len;
+                uint64_t token;
+                if (decode_voice_hello(data, size, token)) {
+                    voice_rooms.bind(token, senders[i]);
+                    continue;
+                }
+                const RelayTable::Room* room = table ? table->find(senders[i]) : nullptr;
+                if (!room) {
+                    ++dropped;
+                    continue;
+                }
+                ++forwarded;
+                uint64_t sender = RelayTable::key(senders[i]);
+                for (uint32_t m = room->begin; m < room->end; ++m) {
+                    const sockaddr_in& to = table->endpoints[m];
+                    if (RelayTable::key(to) != sender) queue_send(data, size, to);
+                }
+            }
+            flush();
+            voice_rooms.table.exit(reader);
+            metrics.voice_packets_in += forwarded;
+            metrics.voice_packets_dropped += dropped;
+        }
+    }
+
+private:
+    // Room for one UDP_SEGMENT control message.
+    union Control {
+        cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(uint16_t))];
+    };
+
+    int fd;
+    size_t batch;
+    bool gso;
+    size_t path_mtu;
+    std::vector<char> buffers;  // `batch` datagrams of max_packet bytes
+    std::vector<sockaddr_in> senders;
+    std::vector<iovec> receive_iov;
+    std::vector<mmsghdr> receive;
+    std::vector<iovec> send_iov;
+    std::vector<mmsghdr> sends;
+    size_t queued = 0;
+
+    // GSO: the queued sends grouped by destination, then one message per
+    // run of equal-sized datagrams to one destination.
+    std::vector<std::pair<uint64_t, uint32_t>> by_destination;  // (key, index into sends)
+    std::vector<iovec> segment_iov;
+    std::vector<mmsghdr> segmented;
+    std::vector<uint32_t> segment_counts;
+    std::vector<Control> controls;
+
+    void queue_send(const char* data, size_t size, const sockaddr_in& to) {
+        if (queued == max_sends) flush();
+        send_iov[queued] = {const_cast<char*>(data), size};
+        sends[queued].msg_hdr.msg_name = const_cast<sockaddr_in*>(&to);
+        ++queued;
+    }
+
+    void flush() {
+        if (gso && queued > 1) {
+            flush_segmented();
+        } else {
+            send_all(sends.data(), queued, nullptr);
+        }
+        queued = 0;
+    }
+
+    void flush_segmented() {
+        for (size_t i = 0; i < queued; ++i) {
+            by_destination[i] = {RelayTable::key(*static_cast<const sockaddr_in*>(sends[i].msg_hdr.msg_name)), static_cast<uint32_t>(i)};
+        }
+        // By index within a destination, so each listener still gets its
+        // datagrams in arrival order.
+        std::sort(by_destination.begin(), by_destination.begin() + queued);
+
+        size_t messages = 0, iovs = 0;
+        for (size_t i = 0; i < queued;) {
+            const msghdr& first = sends[by_destination[i].second].msg_hdr;
+            uint64_t destination = by_destination[i].first;
+            size_t segment = first.msg_iov->iov_len;
+            size_t most = segment + ip_udp_headers <= path_mtu ? max_segments : 1;
+
+            // Equal sizes to one destination; only the last may be shorter.
+            size_t count = 0, bytes = 0;
+            while (i < queued && by_destination[i].first == destination && count < most) {
+                const iovec& next = *sends[by_destination[i].second].msg_hdr.msg_iov;
+                if (next.iov_len > segment || bytes + next.iov_len > max_segment_bytes) break;
+                segment_iov[iovs + count++] = next;
+                bytes += next.iov_len;
+                ++i;
+                if (next.iov_len < segment) break;
+            }
+
+            msghdr& out = segmented[messages].msg_hdr;
+            out = {};
+            out.msg_name = first.msg_name;
+            out.msg_namelen = first.msg_namelen;
+            out.msg_iov = &segment_iov[iovs];
+            out.msg_iovlen = count;
+            if (count > 1) {
+                out.msg_control = controls[messages].buffer;
+                out.msg_controllen = sizeof(controls[messages].buffer);
+                cmsghdr* control = CMSG_FIRSTHDR(&out);
+                control->cmsg_level = IPPROTO_UDP;
+                control->cmsg_type = UDP_SEGMENT;
+                control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t size = static_cast<uint16_t>(segment);
+                std::memcpy(CMSG_DATA(control), &size, sizeof(size));
+            }
+            segment_counts[messages++] = static_cast<uint32_t>(count);
+            iovs += count;
+        }
+        send_all(segmented.data(), messages, segment_counts.data());
+    }
+
+    // sendmmsg until every message is out or given up on. `segments` is the
+    // datagram count of each message, null if they are all plain.
+    void send_all(mmsghdr* messages, size_t count, const uint32_t* segments) {
+        size_t done = 0;
+        uint64_t sent_datagrams = 0;
+        while (done < count) {
+            int sent = sendmmsg(fd, &messages[done], static_cast<unsigned>(count - done), 0);
+            if (sent > 0) {
+                for (int i = 0; i < sent; ++i) sent_datagrams += segments ? segments[done + i] : 1;
+                done += sent;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (segments && segments[done] > 1 && segmentation_refused(errno)) {
+                std::cerr << "[VOICE] UDP GSO refused (" << std::strerror(errno) << "), using sendmmsg" << std::endl;
+                gso = false;
+                sent_datagrams += send_unsegmented(messages[done].msg_hdr);
+                ++done;
+            } else {
+                ++done;  // a stale ICMP error from one destination: skip it, not the rest
+            }
+        }
+        metrics.voice_packets_out += sent_datagrams;
+    }
+
+    // What a refused segmented send would have carried, one datagram each.
+    size_t send_unsegmented(const msghdr& message) {
+        size_t sent = 0;
+        for (size_t i = 0; i < message.msg_iovlen; ++i) {
+            const iovec& datagram = message.msg_iov[i];
+            if (sendto(fd, datagram.iov_base, datagram.iov_len, 0, static_cast<const sockaddr*>(message.msg_name), message.msg_namelen) >= 0) ++sent;
+        }
+        return sent;
+    }
+
+    // The errors UDP_SEGMENT adds: no support, an oversized segment for the
+    // route, or a device that can't checksum it.
+    static bool segmentation_refused(int error) {
+        return error == EINVAL || error == EMSGSIZE || error == EIO || error == ENOPROTOOPT || error == EOPNOTSUPP;
+    }
+};
+
+// `count` relay workers on one port, 1 for a single plain socket. The
+// workers live for the rest of the process.
+inline void voice_relay(int port, unsigned count, unsigned batch, bool gso, size_t path_mtu) {
+    static std::vector<std::unique_ptr<VoiceRelay>> workers;
+    count = std::clamp<unsigned>(count, 1, RcuPointer<RelayTable>::max_readers);
+    for (unsigned i = 0; i < count; ++i) {
+        int fd = open_voice_socket(port, count > 1);
+        if (fd < 0) return;
+        workers.push_back(std::make_unique<VoiceRelay>(fd, batch, gso, path_mtu));
+    }
+    std::cout << "[VOICE] UDP Audio Relay running on port " << port << " with " << count << " worker(s)..." << std::endl;
+    for (auto& worker : workers) std::thread(&VoiceRelay::run, worker.get()).detach();
+}
+
+#endif // VOICE_RELAY_HPP
@@ -14,8 +14,13 @@
 #include <mutex>
 #include <algorithm>
 #include <map>
+#include <atomic>
 #include "../include/json.hpp" 
 #include "../include/base64.hpp" // NEW BASE64 HEADER
+#include "../include/framing.hpp"
+#include "../include/codec.hpp"
+#include "../include/opcodes.hpp"
+#include "../include/voice.hpp"
 #include <portaudio.h>
 
 using namespace ftxui;
@@ -23,6 +28,14 @@ using json = nlohmann::json;
 
 std::mutex chat_mutex;
 
+// What we send in. Starts as JSON and follows the server's OP 2 ack.
+std::atomic<Encoding> wire_encoding{Encoding::json};
+
+void send_payload(int sock, const json& payload) {
+    std::string frame = encode_payload(payload, wire_encoding);
+    send(sock, frame.data(), frame.size(), 0);
+}
+
 // audio chat
 std::map<std::string, std::chrono::steady_clock::time_point> last_voice_activity;
 std::mutex audio_time_mutex;
@@ -49,14 +62,17 @@ bool load_session(std::string& user, std::string& ip) {
 
 bool is_mic_active = false;
 
-void start_voice_chat(std::string target_ip) {
+// Hello every ~2 s of audio, so the relay learns (or relearns) our endpoint.
+#define HELLO_EVERY_BUFFERS (2 * SAMPLE_RATE / FRAMES_PER_BUFFER)
+
+void start_voice_chat(std::string target_ip, int port, uint64_t token) {
     Pa_Initialize();
     is_mic_active = true;
 
     int udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
     sockaddr_in server_addr{};
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(8081);
+    server_addr.sin_port = htons(port);
     inet_pton(AF_INET, target_ip.c_str(), &server_addr.sin_addr);
 
     PaStream *input_stream, *output_stream;
@@ -68,9 +84,16 @@ void start_voice_chat(std::string target_ip) {
 
     std::thread recorder([=]() {
         float buffer[FRAMES_PER_BUFFER];
-        while (is_mic_active) {
+        char hello[voice_hello_size];
+        encode_voice_hello(token, hello);
+        for (int buffers = 0; is_mic_active; ++buffers) {
+            if (buffers % HELLO_EVERY_BUFFERS == 0) sendto(udp_sock, hello, sizeof(hello), 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
             Pa_ReadStream(input_stream, buffer, FRAMES_PER_BUFFER);
-            sendto(udp_sock, buffer, sizeof(buffer), 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+            // In datagrams that fit the path MTU unfragmented.
+            const char* samples = reinterpret_cast<const char*>(buffer);
+            for (size_t sent = 0; sent < sizeof(buffer); sent += voice_max_payload) {
+                sendto(udp_sock, samples + sent, std::min(voice_max_payload, sizeof(buffer) - sent), 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+            }
         }
     });
     recorder.detach();
@@ -84,7 +107,7 @@ void start_voice_chat(std::string target_ip) {
                     std::lock_guard<std::mutex> lock(audio_time_mutex);
                     last_audio_received = std::chrono::steady_clock::now();
                 }
-                Pa_WriteStream(output_stream, buffer, FRAMES_PER_BUFFER);
+                Pa_WriteStream(output_stream, buffer, bytes / sizeof(float));
             }
         }
     });
@@ -99,6 +122,112 @@ void stop_voice_chat() {
 struct Channel { int id; std::string name; };
 struct Server { int id; std::string name; std::vector<Channel> channels; };
 
+// One channel's scrollback, keyed by message id so history pages and live
+// messages can arrive in any order without duplicates. Local notices have
+// no id and sort after the newest message seen when they were added.
+struct ChannelHistory {
+    std::map<std::pair<int64_t, int>, std::string> lines;
+    bool loaded = false;     // the newest page has arrived
+    bool requested = false;  // a page is in flight
+    bool has_more = true;    // the server has older messages
+    int notices = 0;
+
+    void add_message(int64_t id, std::string line) {
+        if (id <= 0) add_notice(std::move(line));
+        else lines.emplace(std::make_pair(id, 0), std::move(line));
+    }
+
+    void add_notice(std::string line) {
+        int64_t newest = lines.empty() ? 0 : lines.rbegin()->first.first;
+        lines.emplace(std::make_pair(newest, ++notices), std::move(line));
+    }
+
+    // Mark a message the server could not store; false if it is not shown.
+    bool mark_failed(int64_t id) {
+        auto it = lines.find({id, 0});
+        if (it == lines.end()) return false;
+        it->second += "  [not saved]";
+        return true;
+    }
+
+    int64_t oldest_id() const {
+        for (auto& [key, line] : lines) {
+            if (key.second == 0) return key.first;
+        }
+        return 0;
+    }
+};
+
+// --- GATEWAY EVENTS ---
+struct EncodingAck { std::string encoding; };
+struct MessageEvent { int64_t id = 0; std::string author; std::string content; int channel_id; };
+struct NameList { std::vector<std::string> names; };
+struct UserEvent { std::string username; };
+struct VoiceEvent { std::string username; bool joining; int channel_id = 0; int64_t token = 0; int port = 8081; };
+struct GuildEvent { int id; std::string name; };
+struct ChannelEvent { int id; int guild_id; std::string name; };
+struct GuildTree { std::vector<Server> guilds; };
+struct FileData { std::string filename; std::string data; };
+struct HistoryPage { int channel_id; std::vector<MessageEvent> messages; bool has_more; bool older; };
+struct SearchResults { std::string query; std::vector<MessageEvent> messages; bool has_more; };
+struct FailedMessage { int64_t id; int channel_id; std::string author; };
+
+bool parse(const json& d, EncodingAck& e) { return read_field(d, "encoding", e.encoding); }
+bool parse(const json& d, MessageEvent& e) {
+    auto author = d.find("author");
+    return author != d.end() && read_field(*author, "username", e.author) && read_field(d, "content", e.content) && read_field(d, "channel_id", e.channel_id) &&
+           read_optional(d, "id", e.id);
+}
+bool parse(const json& d, FailedMessage& e) {
+    auto author = d.find("author");
+    return author != d.end() && read_field(*author, "username", e.author) && read_field(d, "id", e.id) && read_field(d, "channel_id", e.channel_id);
+}
+bool parse(const json& d, NameList& e) { return read_strings(d, e.names); }
+bool parse(const json& d, UserEvent& e) { return read_field(d, "username", e.username); }
+bool parse(const json& d, VoiceEvent& e) {
+    return read_field(d, "username", e.username) && read_field(d, "joining", e.joining) && read_optional(d, "channel_id", e.channel_id) &&
+           read_optional(d, "token", e.token) && read_optional(d, "port", e.port);
+}
+bool parse(const json& d, GuildEvent& e) { return read_field(d, "id", e.id) && read_field(d, "name", e.name); }
+bool parse(const json& d, ChannelEvent& e) { return read_field(d, "id", e.id) && read_field(d, "guild_id", e.guild_id) && read_field(d, "name", e.name); }
+bool parse(const json& d, GuildTree& e) {
+    if (!d.is_array()) return false;
+    for (auto& g : d) {
+        Server server;
+        auto channels = g.find("channels");
+        if (!read_field(g, "id", server.id) || !read_field(g, "name", server.name) || channels == g.end() || !channels->is_array()) return false;
+        for (auto& c : *channels) {
+            Channel channel;
+            if (!read_field(c, "id", channel.id) || !read_field(c, "name", channel.name)) return false;
+            server.channels.push_back(channel);
+        }
+        e.guilds.push_back(std::move(server));
+    }
+    return true;
+}
+bool parse(const json& d, FileData& e) { return read_field(d, "filename", e.filename) && read_field(d, "data", e.data); }
+bool parse(const json& d, HistoryPage& e) {
+    auto messages = d.find("messages");
+    if (!read_field(d, "channel_id", e.channel_id) || !read_field(d, "has_more", e.has_more) || messages == d.end() || !messages->is_array()) return false;
+    for (auto& m : *messages) {
+        MessageEvent message;
+        if (!parse(m, message)) return false;
+        e.messages.push_back(std::move(message));
+    }
+    e.older = d.find("after") == d.end();
+    return true;
+}
+bool parse(const json& d, SearchResults& e) {
+    auto messages = d.find("messages");
+    if (!read_field(d, "query", e.query) || !read_field(d, "has_more", e.has_more) || messages == d.end() || !messages->is_array()) return false;
+    for (auto& m : *messages) {
+        MessageEvent message;
+        if (!parse(m, message)) return false;
+        e.messages.push_back(std::move(message));
+    }
+    return true;
+}
+
 int main(int argc, char* argv[]) {
     std::string target_ip, username, password;
     
@@ -130,9 +259,8 @@ int main(int argc, char* argv[]) {
 
     std::this_thread::sleep_for(std::chrono::milliseconds(200));
 
-    json identify_payload = {{"op", 2}, {"d", {{"username", username}, {"password", password}}}};
-    std::string id_str = identify_payload.dump() + "\n";
-    send(sock, id_str.c_str(), id_str.length(), 0);
+    json identify_payload = {{"op", 2}, {"d", {{"username", username}, {"password", password}, {"encodings", json::array({"msgpack", "cbor"})}}}};
+    send_payload(sock, identify_payload);
 
     std::cout << "[DEBUG] Identifying as: " << username << std::endl;
     
@@ -140,10 +268,20 @@ int main(int argc, char* argv[]) {
     std::vector<Server> discord_tree;
     int selected_server = 0, selected_channel = 0, previous_server = -1; 
     std::vector<std::string> server_names, channel_names, online_users, voice_users;
-    std::map<int, std::vector<std::string>> chat_histories;
+    std::map<int, ChannelHistory> chat_histories;
     bool in_voice = false;    
     std::string input_content, new_server_input, new_channel_input;
     int scroll_offset = 0; 
+    const int max_lines_on_screen = 30;
+
+    // Ask for the page of `channel_id` just older than `before`, or the
+    // newest page when it is 0. Called with chat_mutex held.
+    auto request_history = [&](int channel_id, ChannelHistory& history, int64_t before) {
+        history.requested = true;
+        json req = {{"op", 13}, {"d", {{"channel_id", channel_id}, {"limit", 50}}}};
+        if (before > 0) req["d"]["before"] = before;
+        send_payload(sock, req);
+    };
 
     // UI 
     auto server_menu = Menu(&server_names, &selected_server);
@@ -155,8 +293,7 @@ int main(int argc, char* argv[]) {
     auto new_server_handler = CatchEvent(new_server_box, [&](Event e) {
         if (e == Event::Return && !new_server_input.empty()) {
             json req = {{"op", 7}, {"d", {{"name", new_server_input}}}};
-            std::string payload = req.dump() + "\n";
-            send(sock, payload.c_str(), payload.length(), 0);
+            send_payload(sock, req);
             new_server_input.clear();
             return true;
         }
@@ -166,8 +303,7 @@ int main(int argc, char* argv[]) {
     auto new_channel_handler = CatchEvent(new_channel_box, [&](Event e) {
         if (e == Event::Return && !new_channel_input.empty() && !discord_tree.empty()) {
             json req = {{"op", 8}, {"d", {{"guild_id", discord_tree[selected_server].id}, {"name", new_channel_input}}}};
-            std::string payload = req.dump() + "\n";
-            send(sock, payload.c_str(), payload.length(), 0);
+            send_payload(sock, req);
             new_channel_input.clear();
             return true;
         }
@@ -178,13 +314,17 @@ int main(int argc, char* argv[]) {
         if (event == Event::Return && !input_content.empty()) {
             
             if (input_content.find("/voice") == 0) {
-                in_voice = !in_voice;
-                if (in_voice) start_voice_chat(target_ip);
-                else stop_voice_chat();
-
-                json voice_out = {{"op", 6}, {"d", {{"joining", in_voice}}}};
-                std::string v_payload = voice_out.dump() + "\n";
-                send(sock, v_payload.c_str(), v_payload.length(), 0);
+                // Joining waits for the server's token; see the OP 6 handler.
+                std::lock_guard<std::mutex> lock(chat_mutex);
+                json voice_out = {{"op", 6}, {"d", {{"joining", !in_voice}}}};
+                if (!in_voice && !discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
+                    voice_out["d"]["channel_id"] = discord_tree[selected_server].channels[selected_channel].id;
+                    send_payload(sock, voice_out);
+                } else if (in_voice) {
+                    in_voice = false;
+                    stop_voice_chat();
+                    send_payload(sock, voice_out);
+                }
                 input_content.clear();
                 return true;
             }
@@ -207,8 +347,7 @@ int main(int argc, char* argv[]) {
                         }}
                     };
                         
-                    std::string payload = file_req.dump() + "\n";
-                    send(sock, payload.c_str(), payload.length(), 0);
+                    send_payload(sock, file_req);
                 }
                 input_content.clear();
                 return true;
@@ -217,8 +356,19 @@ int main(int argc, char* argv[]) {
             // Get file list
             if (input_content == "/files") {
                 json req = {{"op", 11}, {"d", {}}};
-                std::string p = req.dump() + "\n";
-                send(sock, p.c_str(), p.length(), 0);
+                send_payload(sock, req);
+                input_content.clear();
+                return true;
+            }
+
+            // Search the active channel, or every channel with /searchall
+            bool search_all = input_content.find("/searchall ") == 0;
+            if (search_all || input_content.find("/search ") == 0) {
+                json req = {{"op", 14}, {"d", {{"query", input_content.substr(search_all ? 11 : 8)}}}};
+                if (!search_all && !discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
+                    req["d"]["channel_id"] = discord_tree[selected_server].channels[selected_channel].id;
+                }
+                send_payload(sock, req);
                 input_content.clear();
                 return true;
             }
@@ -227,8 +377,7 @@ int main(int argc, char* argv[]) {
             if (input_content.find("/get ") == 0) {
                 std::string filename = input_content.substr(5);
                 json req = {{"op", 12}, {"d", {{"filename", filename}}}};
-                std::string p = req.dump() + "\n";
-                send(sock, p.c_str(), p.length(), 0);
+                send_payload(sock, req);
                 input_content.clear();
                 return true;
             }            
@@ -239,8 +388,7 @@ int main(int argc, char* argv[]) {
                     {"op", 0}, {"t", "MESSAGE_CREATE"},
                     {"d", {{"content", input_content}, {"channel_id", active_channel_id}}}
                 };
-                std::string payload = outbound.dump() + "\n";
-                send(sock, payload.c_str(), payload.length(), 0);
+                send_payload(sock, outbound);
             }
             
             input_content.clear();
@@ -248,7 +396,19 @@ int main(int argc, char* argv[]) {
             return true;
         }
         
-        if (event == Event::ArrowUp) { scroll_offset++; return true; }
+        if (event == Event::ArrowUp) {
+            scroll_offset++;
+            // Scrolled to the top of what we have: page in the next older batch.
+            std::lock_guard<std::mutex> lock(chat_mutex);
+            if (!discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
+                int active_channel_id = discord_tree[selected_server].channels[selected_channel].id;
+                auto& history = chat_histories[active_channel_id];
+                if (history.loaded && history.has_more && !history.requested && scroll_offset >= (int)history.lines.size() - max_lines_on_screen) {
+                    request_history(active_channel_id, history, history.oldest_id());
+                }
+            }
+            return true;
+        }
         if (event == Event::ArrowDown) { scroll_offset--; return true; }
         return false;
     });
@@ -260,89 +420,112 @@ int main(int argc, char* argv[]) {
 
     auto screen = ScreenInteractive::Fullscreen();
 
+    auto post_to_active_channel = [&](const std::string& line) {
+        if (!discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
+            int active_id = discord_tree[selected_server].channels[selected_channel].id;
+            chat_histories[active_id].add_notice(line);
+        }
+    };
+
+    // Event handlers, run on the listener thread under chat_mutex
+    Dispatcher<> events;
+    events.on<EncodingAck>(Op::identify, [&](const EncodingAck& e) {
+        Encoding negotiated;
+        if (parse_encoding(e.encoding, negotiated)) wire_encoding = negotiated;
+    });
+    events.on<MessageEvent>(Op::message_create, [&](const MessageEvent& e) {
+        chat_histories[e.channel_id].add_message(e.id, e.author + ": " + e.content);
+        if (!discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
+            if (e.channel_id == discord_tree[selected_server].channels[selected_channel].id) scroll_offset = 0;
+        }
+    });
+    // Shown already (the server broadcasts before committing by default), or
+    // never shown because it was waiting for the commit: then only the
+    // sender hears about it.
+    events.on<FailedMessage>(Op::message_failed, [&](const FailedMessage& e) {
+        auto& history = chat_histories[e.channel_id];
+        if (!history.mark_failed(e.id) && e.author == username) history.add_notice("SYSTEM: Your message could not be saved and was not sent.");
+    });
+    events.on<NameList>(Op::presence, [&](const NameList& e) { online_users = e.names; });
+    events.on<UserEvent>(Op::user_joined, [&](const UserEvent& e) { online_users.push_back(e.username); });
+    events.on<UserEvent>(Op::user_left, [&](const UserEvent& e) {
+        online_users.erase(std::remove(online_users.begin(), online_users.end(), e.username), online_users.end());
+        voice_users.erase(std::remove(voice_users.begin(), voice_users.end(), e.username), voice_users.end());
+    });
+    events.on<VoiceEvent>(Op::voice_state, [&](const VoiceEvent& e) {
+        if (e.token != 0 && e.username == username && !in_voice) {
+            in_voice = true;
+            start_voice_chat(target_ip, e.port, static_cast<uint64_t>(e.token));
+        }
+        if (e.joining) {
+            if (std::find(voice_users.begin(), voice_users.end(), e.username) == voice_users.end()) voice_users.push_back(e.username);
+        } else { voice_users.erase(std::remove(voice_users.begin(), voice_users.end(), e.username), voice_users.end()); }
+    });
+    // A create can race a login and also be in the OP 9 tree we got; skip ids we already have.
+    events.on<GuildEvent>(Op::guild_create, [&](const GuildEvent& e) {
+        for (auto& s : discord_tree) if (s.id == e.id) return;
+        discord_tree.push_back({e.id, e.name, {}});
+    });
+    events.on<ChannelEvent>(Op::channel_create, [&](const ChannelEvent& e) {
+        for (auto& s : discord_tree) {
+            if (s.id != e.guild_id) continue;
+            for (auto& c : s.channels) if (c.id == e.id) return;
+            s.channels.push_back({e.id, e.name});
+            break;
+        }
+    });
+    events.on<GuildTree>(Op::guild_tree, [&](const GuildTree& e) { discord_tree = e.guilds; });
+    events.on<NameList>(Op::file_list, [&](const NameList& e) {
+        std::string list_str = "SERVER FILES: ";
+        for (auto& f : e.names) list_str += "[" + f + "] ";
+        post_to_active_channel("SYSTEM: " + list_str);
+    });
+    events.on<HistoryPage>(Op::history, [&](const HistoryPage& e) {
+        auto& history = chat_histories[e.channel_id];
+        for (auto& m : e.messages) history.add_message(m.id, m.author + ": " + m.content);
+        history.requested = false;
+        if (e.older) {
+            history.loaded = true;
+            history.has_more = e.has_more;
+        }
+    });
+    events.on<SearchResults>(Op::search, [&](const SearchResults& e) {
+        post_to_active_channel("SYSTEM: " + std::to_string(e.messages.size()) + (e.has_more ? "+" : "") + " results for '" + e.query + "'");
+        for (auto& m : e.messages) {
+            std::string where = "#" + std::to_string(m.channel_id);
+            for (auto& s : discord_tree) {
+                for (auto& c : s.channels) if (c.id == m.channel_id) where = "#" + c.name;
+            }
+            post_to_active_channel("  " + where + " " + m.author + ": " + m.content);
+        }
+    });
+    // FILE DOWNLOAD (BASE64 DECODED)
+    events.on<FileData>(Op::file_download, [&](const FileData& e) {
+        std::string decoded_data = base64_decode(e.data); // DECODE TO BINARY
+        std::ofstream outfile("downloaded_" + e.filename, std::ios::binary);
+        if (outfile.is_open()) {
+            outfile << decoded_data;
+            outfile.close();
+            post_to_active_channel("SYSTEM: Saved 'downloaded_" + e.filename + "'");
+        }
+    });
+
     // Listener Thread
     std::thread listener([&]() {
-        char buffer[8192];
+        FrameBuffer inbound;
         while (true) {
-            int bytes = recv(sock, buffer, sizeof(buffer) - 1, 0);
+            auto [space, len] = inbound.write_space();
+            int bytes = recv(sock, space, len, 0);
             if (bytes > 0) {
-                buffer[bytes] = '\0';
+                inbound.commit(bytes);
                 
-                std::string data(buffer);
-                size_t pos = 0;
-                while ((pos = data.find('\n')) != std::string::npos) {
-                    std::string line = data.substr(0, pos);
-                    data.erase(0, pos + 1);
-
+                std::string_view line;
+                while (inbound.next_frame(line)) {
                     try {
-                        if (line.empty() || line[0] != '{') continue;
-                        json incoming = json::parse(line);
+                        if (line.empty()) continue;
+                        json incoming = decode_payload(line);
                         std::lock_guard<std::mutex> lock(chat_mutex);
-
-                        if (incoming["op"] == 0) {
-                            std::string author = incoming["d"]["author"]["username"];
-                            std::string content = incoming["d"]["content"];
-                            int ch_id = incoming["d"]["channel_id"];
-                            chat_histories[ch_id].push_back(author + ": " + content);
-                            if (!discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
-                                if (ch_id == discord_tree[selected_server].channels[selected_channel].id) scroll_offset = 0;
-                            }
-                        }
-                        else if (incoming["op"] == 3) { 
-                            online_users.clear();
-                            for (auto& u : incoming["d"]) online_users.push_back(u);
-                        }
-                        else if (incoming["op"] == 4) { online_users.push_back(incoming["d"]["username"]); }
-                        else if (incoming["op"] == 5) { 
-                            std::string left_user = incoming["d"]["username"];
-                            online_users.erase(std::remove(online_users.begin(), online_users.end(), left_user), online_users.end());
-                            voice_users.erase(std::remove(voice_users.begin(), voice_users.end(), left_user), voice_users.end());
-                        }
-                        else if (incoming["op"] == 6) { 
-                            std::string v_user = incoming["d"]["username"];
-                            if (incoming["d"]["joining"]) {
-                                if (std::find(voice_users.begin(), voice_users.end(), v_user) == voice_users.end()) voice_users.push_back(v_user);
-                            } else { voice_users.erase(std::remove(voice_users.begin(), voice_users.end(), v_user), voice_users.end()); }
-                        }
-                        else if (incoming["op"] == 7) { discord_tree.push_back({incoming["d"]["id"], incoming["d"]["name"], {}}); }
-                        else if (incoming["op"] == 8) { 
-                            int g_id = incoming["d"]["guild_id"];
-                            for (auto& s : discord_tree) {
-                                if (s.id == g_id) { s.channels.push_back({incoming["d"]["id"], incoming["d"]["name"]}); break; }
-                            }
-                        }
-                        else if (incoming["op"] == 9) { 
-                            discord_tree.clear();
-                            for (auto& g : incoming["d"]) {
-                                Server new_server{g["id"], g["name"], {}};
-                                for (auto& c : g["channels"]) new_server.channels.push_back({c["id"], c["name"]});
-                                discord_tree.push_back(new_server);
-                            }
-                        }
-                        else if (incoming["op"] == 11) {
-                            std::string list_str = "SERVER FILES: ";
-                            for (auto& f : incoming["d"]) list_str += "[" + std::string(f) + "] ";
-                            if (!discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
-                                int active_id = discord_tree[selected_server].channels[selected_channel].id;
-                                chat_histories[active_id].push_back("SYSTEM: " + list_str);
-                            }
-                        }
-                        // FILE DOWNLOAD (BASE64 DECODED) 
-                        else if (incoming["op"] == 12) {
-                            std::string filename = incoming["d"]["filename"];
-                            std::string encoded_data = incoming["d"]["data"];
-                            std::string decoded_data = base64_decode(encoded_data); // DECODE TO BINARY
-                            
-                            std::ofstream outfile("downloaded_" + filename, std::ios::binary);
-                            if (outfile.is_open()) {
-                                outfile << decoded_data;
-                                outfile.close();
-                                if (!discord_tree.empty() && !discord_tree[selected_server].channels.empty()) {
-                                    int active_id = discord_tree[selected_server].channels[selected_channel].id;
-                                    chat_histories[active_id].push_back("SYSTEM: Saved 'downloaded_" + filename + "'");
-                                }
-                            }
-                        }                        
+                        events.dispatch(incoming);
                     } catch (const std::exception& e) { continue; }
                 }
             } else { break; }
@@ -401,8 +584,8 @@ int main(int argc, char* argv[]) {
             current_c_name = "#" + discord_tree[selected_server].channels[selected_channel].name;
             
             auto& current_chat = chat_histories[active_channel_id]; 
-            int max_lines_on_screen = 30; 
-            int total_msgs = current_chat.size();
+            if (!current_chat.loaded && !current_chat.requested) request_history(active_channel_id, current_chat, 0);
+            int total_msgs = current_chat.lines.size();
             
             if (scroll_offset < 0) scroll_offset = 0;
             int max_scroll = std::max(0, total_msgs - max_lines_on_screen);
@@ -412,7 +595,8 @@ int main(int argc, char* argv[]) {
             int end_idx = std::min(total_msgs, start_idx + max_lines_on_screen);
 
             if (total_msgs < max_lines_on_screen) message_list.push_back(filler());
-            for (int i = start_idx; i < end_idx; ++i) message_list.push_back(text(current_chat[i]));
+            auto line = std::next(current_chat.lines.begin(), start_idx);
+            for (int i = start_idx; i < end_idx; ++i, ++line) message_list.push_back(text(line->second));
         } else {
             message_list.push_back(filler());
             message_list.push_back(text("Create a channel to start chatting!") | center | dim);